@@ -0,0 +1,183 @@
+// Benchmarks the alias table sampler of MarkovChain::next_state against building a std::discrete_distribution from
+// the current row on every step, which is what next_state used to do, and FixedMarkovChain<N> against MarkovChain for
+// small chains that are known when building. Also times iterate_markov_trajectories with different numbers of threads
+// and fails if they do not produce the same trajectories.
+//
+// Build and run with `make bench`.
+
+#include "fixed_markov.hpp"
+#include "markov.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr double MIN_SECONDS = 0.5;
+constexpr std::size_t BATCH_STEPS = 1024;
+constexpr std::uint64_t SEED = 1453;
+constexpr std::size_t TRAJECTORY_STATES = 100;
+constexpr std::size_t TRAJECTORY_COUNT = 256;
+constexpr std::size_t TRAJECTORY_ITERATIONS = 10000;
+
+// Declared constexpr so that the matrices are validated when building.
+constexpr FixedTransitionMatrix<3> FIXED_MATRIX_3({{{0.5, 0.25, 0.25}, {0.2, 0.3, 0.5}, {0.1, 0.6, 0.3}}});
+constexpr FixedTransitionMatrix<4> FIXED_MATRIX_4(
+    {{{0.1, 0.2, 0.3, 0.4}, {0.25, 0.25, 0.25, 0.25}, {0.7, 0.1, 0.1, 0.1}, {0.4, 0.3, 0.2, 0.1}}});
+constexpr FixedTransitionMatrix<8> FIXED_MATRIX_8({{{0.5, 0.5, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+                                                    {0.0, 0.5, 0.5, 0.0, 0.0, 0.0, 0.0, 0.0},
+                                                    {0.0, 0.0, 0.5, 0.5, 0.0, 0.0, 0.0, 0.0},
+                                                    {0.0, 0.0, 0.0, 0.5, 0.5, 0.0, 0.0, 0.0},
+                                                    {0.0, 0.0, 0.0, 0.0, 0.5, 0.5, 0.0, 0.0},
+                                                    {0.0, 0.0, 0.0, 0.0, 0.0, 0.5, 0.5, 0.0},
+                                                    {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.5, 0.5},
+                                                    {0.5, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.5}}});
+
+std::vector<std::vector<double>> random_transition_matrix(std::size_t n, std::mt19937 &generator) {
+  std::uniform_real_distribution<double> weight(0.0, 1.0);
+  std::vector<std::vector<double>> transition_matrix(n, std::vector<double>(n));
+
+  for (auto &row : transition_matrix) {
+    double sum = 0.0;
+    for (double &prob : row) {
+      prob = weight(generator);
+      sum += prob;
+    }
+    for (double &prob : row) {
+      prob /= sum;
+    }
+  }
+  return transition_matrix;
+}
+
+// Runs step() in batches until MIN_SECONDS have passed and returns the number of steps per second.
+template <typename Step> double steps_per_second(Step step) {
+  std::size_t steps = 0;
+  const auto start = bench_clock::now();
+  std::chrono::duration<double> elapsed{0};
+
+  while (elapsed.count() < MIN_SECONDS) {
+    for (std::size_t i = 0; i < BATCH_STEPS; i++) {
+      step();
+    }
+    steps += BATCH_STEPS;
+    elapsed = bench_clock::now() - start;
+  }
+  return static_cast<double>(steps) / elapsed.count();
+}
+
+// Prints the steps per second of a MarkovChain and a FixedMarkovChain<N> with the same transition matrix.
+template <std::size_t N> void compare_fixed_chain(const FixedTransitionMatrix<N> &fixed_matrix) {
+  volatile std::size_t sink = 0;
+  std::vector<std::vector<double>> transition_matrix(N, std::vector<double>(N));
+  for (std::size_t i = 0; i < N; i++) {
+    for (std::size_t j = 0; j < N; j++) {
+      transition_matrix[i][j] = fixed_matrix.probability(i, j);
+    }
+  }
+
+  MarkovChain mc(transition_matrix);
+  FixedMarkovChain<N> fixed_mc(fixed_matrix);
+  mc.set_seed(SEED);
+  fixed_mc.set_seed(SEED);
+
+  const double alias = steps_per_second([&] { sink = mc.next_state(); });
+  const double fixed = steps_per_second([&] { sink = fixed_mc.next_state(); });
+
+  std::cout << std::setw(8) << N << std::setw(20) << std::fixed << std::setprecision(0) << alias << std::setw(20)
+            << fixed << std::setw(11) << std::setprecision(1) << fixed / alias << "x" << std::endl;
+}
+
+// Generates the same trajectories with 1, 2, 4 and every hardware thread and prints the steps per second. Returns
+// whether every thread count produced the trajectories of a single thread, and trajectory 0 the states of
+// iterate_markov_states.
+bool compare_trajectory_threads(std::mt19937 &generator) {
+  const auto transition_matrix = random_transition_matrix(TRAJECTORY_STATES, generator);
+  MarkovChain mc(transition_matrix);
+  mc.set_seed(SEED);
+  mc.set_current_state(0);
+
+  std::vector<std::size_t> thread_counts = {1, 2, 4, hardware_threads()};
+  std::sort(thread_counts.begin(), thread_counts.end());
+  thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()), thread_counts.end());
+
+  std::vector<std::vector<std::size_t>> single_thread;
+  bool identical = true;
+  for (std::size_t thread_count : thread_counts) {
+    const auto start = bench_clock::now();
+    const auto trajectories = iterate_markov_trajectories(mc, TRAJECTORY_COUNT, TRAJECTORY_ITERATIONS, thread_count);
+    const std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    if (single_thread.empty()) {
+      single_thread = trajectories;
+    }
+    const bool same = trajectories == single_thread;
+    identical = identical && same;
+
+    const double steps = static_cast<double>(TRAJECTORY_COUNT * TRAJECTORY_ITERATIONS);
+    std::cout << std::setw(8) << thread_count << std::setw(20) << std::fixed << std::setprecision(0)
+              << steps / elapsed.count() << std::setw(12) << (same ? "yes" : "no") << std::endl;
+  }
+
+  MarkovChain sequential(transition_matrix);
+  sequential.set_seed(SEED);
+  sequential.set_current_state(0);
+  const bool first_matches = iterate_markov_states(sequential, TRAJECTORY_ITERATIONS) == single_thread[0];
+  if (!first_matches) {
+    std::cout << "Trajectory 0 differs from iterate_markov_states." << std::endl;
+  }
+  return identical && first_matches;
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 generator(SEED);
+  volatile std::size_t sink = 0;
+
+  std::cout << std::setw(8) << "states" << std::setw(20) << "discrete steps/s" << std::setw(20) << "alias steps/s"
+            << std::setw(12) << "speedup" << std::endl;
+
+  for (std::size_t n : {3, 10, 100, 1000, 10000}) {
+    const auto transition_matrix = random_transition_matrix(n, generator);
+    MarkovChain mc(transition_matrix);
+
+    std::size_t state = 0;
+    const double discrete = steps_per_second([&] {
+      std::discrete_distribution<std::size_t> distribution(transition_matrix[state].begin(),
+                                                           transition_matrix[state].end());
+      state = distribution(generator);
+      sink = state;
+    });
+    const double alias = steps_per_second([&] { sink = mc.next_state(); });
+
+    std::cout << std::setw(8) << n << std::setw(20) << std::fixed << std::setprecision(0) << discrete << std::setw(20)
+              << alias << std::setw(11) << std::setprecision(1) << alias / discrete << "x" << std::endl;
+  }
+
+  std::cout << std::endl;
+  std::cout << std::setw(8) << "states" << std::setw(20) << "alias steps/s" << std::setw(20) << "fixed steps/s"
+            << std::setw(12) << "speedup" << std::endl;
+
+  compare_fixed_chain(FIXED_MATRIX_3);
+  compare_fixed_chain(FIXED_MATRIX_4);
+  compare_fixed_chain(FIXED_MATRIX_8);
+
+  std::cout << std::endl;
+  std::cout << std::setw(8) << "threads" << std::setw(20) << "trajectory steps/s" << std::setw(12) << "identical"
+            << std::endl;
+
+  if (!compare_trajectory_threads(generator)) {
+    std::cerr << "The trajectories depend on the number of threads." << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Walker/Vose alias tables for every row of a transition matrix. All rows live in flat arrays, so sampling a row is
+// O(1) and never allocates.
+class AliasTable {
+public:
+  // Appends the alias table of a row. weights[k] is the (unnormalized) probability of moving to columns[k], or to k
+  // if columns is nullptr. Entries with a weight of zero are never sampled.
+  void add_row(const double *weights, const std::uint32_t *columns, std::size_t count);
+  // Samples a column of the row using a uniformly distributed value u in [0, 1).
+  std::size_t sample(std::size_t row, double u) const;
+
+  // Returns the number of rows in the table.
+  std::size_t size() const;
+  // Removes every row from the table.
+  void clear();
+
+private:
+  std::vector<std::size_t> row_offsets{0};
+  std::vector<double> probabilities;
+  std::vector<std::uint32_t> outcomes;
+  std::vector<std::uint32_t> aliases;
+};
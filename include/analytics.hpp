@@ -0,0 +1,85 @@
+#pragma once
+
+#include "markov.hpp"
+#include "transition_matrix.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+// Computes long-run properties of a Markov Chain without sampling it. Every product with the transition matrix is a
+// row kernel over a dense or CSR matrix, split across threads for large chains.
+class MarkovAnalyzer {
+public:
+  // thread_count = 0 uses every hardware thread.
+  MarkovAnalyzer(const TransitionMatrix &transition_matrix, std::size_t thread_count = 0);
+
+  // Returns distribution * P, the distribution after one more step.
+  std::vector<double> step_distribution(const std::vector<double> &distribution) const;
+  // Returns P * values, the expected value of values after one step from every state.
+  std::vector<double> step_expectation(const std::vector<double> &values) const;
+
+  // Computes the stationary distribution by power iteration on the lazy chain (I + P) / 2, which has the same
+  // stationary distribution but also converges for periodic chains. Stops once the L1 change of an iteration is below
+  // tolerance. iterations_used is set to the number of iterations, and converged to whether the last change was below
+  // tolerance.
+  std::vector<double> stationary_distribution(double tolerance, std::size_t max_iterations,
+                                              std::size_t &iterations_used, bool &converged) const;
+  // Returns the distribution after n steps from start_state, that is, row start_state of P^n.
+  std::vector<double> n_step_distribution(std::size_t start_state, std::size_t n) const;
+  // Returns the expected number of steps to reach target_state from every state. States that cannot reach it get
+  // infinity. Value iteration stops once the relative change of an iteration is below tolerance. iterations_used is set
+  // to the number of iterations, and converged to whether the last change was below tolerance.
+  std::vector<double> expected_hitting_times(std::size_t target_state, double tolerance, std::size_t max_iterations,
+                                             std::size_t &iterations_used, bool &converged) const;
+  // Estimates the mixing time, the first t with a total variation distance of at most threshold between P^t(x, .) and
+  // the stationary distribution. Up to sample_count evenly spaced start states x are used. Returns std::nullopt if
+  // some start state has not mixed after mixing_step_limit() steps. Every step costs a product with the matrix per
+  // start state, so check mixes() first: a chain that never mixes always runs to the limit.
+  std::optional<std::size_t> mixing_time(const std::vector<double> &stationary, double threshold,
+                                         std::size_t sample_count, std::size_t max_steps) const;
+  // Returns whether P^t(x, .) converges to the stationary distribution from every state x, that is, whether the chain
+  // has a single closed class and that class is aperiodic. Takes time linear in the stored entries.
+  bool mixes() const;
+  // Returns how many steps mixing_time() tries: max_steps, lowered so that the products with the matrix take at most
+  // MIXING_MAX_WORK multiply-adds.
+  std::size_t mixing_step_limit(std::size_t sample_count, std::size_t max_steps) const;
+
+private:
+  const TransitionMatrix &transition_matrix;
+  TransitionMatrix transpose;
+  std::size_t thread_count;
+
+  // Writes matrix * x to result.
+  void multiply(const TransitionMatrix &matrix, const std::vector<double> &x, std::vector<double> &result) const;
+};
+
+// Everything --analyze reports about a Markov Chain.
+struct MarkovAnalysis {
+  std::vector<double> stationary;
+  std::size_t stationary_iterations;
+  bool stationary_converged;
+  std::size_t start_state;
+  std::size_t n_steps;
+  std::vector<double> n_step;
+  std::size_t hitting_target;
+  std::vector<double> hitting_times;
+  std::size_t hitting_iterations;
+  bool hitting_converged;
+  double mixing_threshold;
+  // False if the chain is periodic or has more than one closed class, so that it never mixes.
+  bool mixes;
+  std::size_t mixing_max_steps;
+  std::optional<std::size_t> mixing_time;
+};
+
+// Analyzes the Markov Chain from its current state. The n-step distribution uses n_steps steps and the hitting times
+// are measured to hitting_target.
+MarkovAnalysis analyze_markov_chain(const MarkovChain &mc, std::size_t n_steps, std::size_t hitting_target,
+                                    std::size_t thread_count = 0);
+// Prints the analysis as a table with a row per state.
+void print_markov_analysis(const MarkovAnalysis &analysis, const MarkovChain &mc, std::ostream &output);
+// Writes the analysis as a JSON document to output_path.
+void write_markov_analysis_json(const MarkovAnalysis &analysis, const MarkovChain &mc,
+                                const std::filesystem::path &output_path);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "markov.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// A 128 bit MurmurHash3 over everything an artifact is built from, fed in 16 byte blocks so that hashing large clips
+// stays fast. Strings are prefixed with their length so that consecutive fields cannot run into each other.
+class CacheKey {
+public:
+  CacheKey &add(std::string_view text);
+  CacheKey &add(std::uint64_t value);
+  CacheKey &add(double value);
+  // Adds the contents of the file. Throws if it cannot be read.
+  CacheKey &add_file(const std::filesystem::path &file_path);
+  // Adds the state names and the non-zero transitions of every state, which is everything a graph shows.
+  CacheKey &add_model(const MarkovModel &mc);
+
+  // Returns the hash as 32 hexadecimal digits.
+  std::string hex() const;
+
+private:
+  static constexpr std::size_t BLOCK_SIZE = 16;
+
+  std::uint64_t h1 = 0;
+  std::uint64_t h2 = 0;
+  std::uint64_t length = 0;
+  // The bytes added since the last whole block.
+  unsigned char pending[BLOCK_SIZE] = {};
+  std::size_t pending_size = 0;
+
+  void add_bytes(const void *data, std::size_t size);
+  void mix_block(std::uint64_t k1, std::uint64_t k2);
+};
+
+// A directory of build artifacts that persists across runs. Every artifact is stored under its key, so an artifact is
+// reused whenever the inputs hash to the same key. When the directory grows beyond max_bytes the least recently used
+// artifacts are removed. The cache may be used from multiple threads and by several runs at once.
+class ArtifactCache {
+public:
+  ArtifactCache(const std::filesystem::path &cache_directory, std::uintmax_t max_bytes);
+
+  // Copies the artifact stored under key to destination_path and marks it as recently used. Returns false if there is
+  // no such artifact.
+  bool fetch(const CacheKey &key, const std::string &extension, const std::filesystem::path &destination_path) const;
+  // Stores a copy of source_path under key. If the cache grew beyond max_bytes, evicts artifacts until it fits again
+  // with some room to spare.
+  void store(const CacheKey &key, const std::string &extension, const std::filesystem::path &source_path) const;
+
+private:
+  std::filesystem::path cache_directory;
+  std::uintmax_t max_bytes;
+  mutable std::mutex cache_mutex;
+  // Size of the artifacts, counted once when the cache is opened and then kept up to date by the stores.
+  mutable std::uintmax_t total_bytes = 0;
+
+  std::filesystem::path artifact_path(const CacheKey &key, const std::string &extension) const;
+  // Scans the directory and removes the least recently used artifacts. Needs cache_mutex unless called from the
+  // constructor.
+  void evict() const;
+};
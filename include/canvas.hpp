@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An 8 bit RGB color.
+struct Color {
+  std::uint8_t r;
+  std::uint8_t g;
+  std::uint8_t b;
+};
+
+// A point in pixel coordinates. Pixel (x, y) covers [x, x + 1) x [y, y + 1).
+struct Point {
+  double x;
+  double y;
+};
+
+// An RGB raster with antialiased drawing primitives. Shapes are rendered analytically: the coverage of each pixel is
+// estimated from its distance to the outline, so edges are smooth without supersampling.
+class Canvas {
+public:
+  Canvas(std::size_t width, std::size_t height, Color background);
+
+  std::size_t width() const;
+  std::size_t height() const;
+  // Returns the pixels as rows of RGB triplets, top row first.
+  const std::vector<std::uint8_t> &pixels() const;
+
+  // Fills the circle around center with the given radius.
+  void fill_circle(Point center, double radius, Color color);
+  // Draws the outline of the circle around center with the given radius and line width.
+  void stroke_circle(Point center, double radius, double line_width, Color color);
+  // Draws connected line segments through points with round joins and caps.
+  void stroke_polyline(const std::vector<Point> &points, double line_width, Color color);
+  // Fills a convex polygon. The points may be in either winding order.
+  void fill_convex_polygon(const std::vector<Point> &points, Color color);
+  // Draws text with the bundled 5x7 font, each font pixel scale pixels wide. top_left is the top left corner of the
+  // first glyph.
+  void draw_text(Point top_left, const std::string &text, std::size_t scale, Color color);
+
+  // Copies sprite over the canvas with its top left corner at pixel (x, y). Parts outside the canvas are skipped.
+  void blit(const Canvas &sprite, std::size_t x, std::size_t y);
+
+  // Returns the width of text drawn with draw_text at scale.
+  static std::size_t text_width(const std::string &text, std::size_t scale);
+  // Returns the height of text drawn with draw_text at scale.
+  static std::size_t text_height(std::size_t scale);
+
+private:
+  std::size_t canvas_width;
+  std::size_t canvas_height;
+  std::vector<std::uint8_t> data;
+
+  // Blends color over pixel (x, y) with the given coverage in [0, 1].
+  void blend(std::size_t x, std::size_t y, Color color, double coverage);
+  // Clamps the pixel range [min, max] of a shape to the canvas. Returns false if nothing is left.
+  bool clip(double min_x, double min_y, double max_x, double max_y, std::size_t &x0, std::size_t &y0, std::size_t &x1,
+            std::size_t &y1) const;
+};
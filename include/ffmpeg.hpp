@@ -1,25 +1,92 @@
 #pragma once
 
+#include "artifact_cache.hpp"
+#include "helpers.hpp"
+#include "markov.hpp"
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <string>
 #include <vector>
 
-// Uses ffmpeg to overlay a PNG image to the specified video.
+// Uses ffmpeg to overlay a PNG image to the specified video. ffmpeg picks its own thread count if threads is 0.
 void overlay_image_to_video(const std::filesystem::path &video_file_path, const std::filesystem::path &image_file_path,
-                            const std::filesystem::path &output_video_path, bool verbose);
-// Overlays multiple images and videos using the file_count as an index.
-void overlay_images_to_videos(const std::filesystem::path &videos_folder_path, const std::string &video_extension,
-                              const std::filesystem::path &images_folder_path, std::size_t file_count,
-                              const std::filesystem::path &outputs_folder_path, bool verbose = false);
+                            const std::filesystem::path &output_video_path, bool verbose, std::size_t threads = 0);
+// The properties of a clip that survive overlaying it, which have to match between all overlaid segments for the concat
+// demuxer to copy their streams. The codec and GOP of a segment are chosen by the encoder of the overlay instead.
+struct ClipProfile {
+  std::size_t width = 0;
+  std::size_t height = 0;
+  std::string pixel_format;
+  // As a fraction, e.g. "30000/1001".
+  std::string frame_rate;
+  // 0 if the clip has no audio.
+  std::size_t sample_rate = 0;
+  std::size_t channels = 0;
 
-// Takes in a vector of Markov Chain states, and creates a filelist for ffmpeg to merge the videos together. The output
-// path is filelist_path.
-void create_filelist(const std::vector<std::size_t> &markov_states, const std::filesystem::path &filelist_path,
-                     const std::string &overlay_name, const std::string &file_extension);
+  bool operator==(const ClipProfile &other) const;
+  bool operator!=(const ClipProfile &other) const { return !(*this == other); }
+  // Describes the profile like "1920x1080 yuv420p 30/1, 48000 Hz 2 channels".
+  std::string to_string() const;
+};
+
+// Uses ffprobe to read the profile of the first video and audio stream of a clip.
+ClipProfile probe_clip(const std::filesystem::path &video_file_path);
+// Returns the most common of the profiles, so that as few clips as possible are re-encoded. Throws if there are none.
+ClipProfile canonical_clip_profile(const std::vector<ClipProfile> &profiles);
+// Re-encodes the clip, whose profile is clip_profile, to profile with closed GOPs, scaling it into the frame of profile
+// without distorting it. If a cache is given, a clip normalized before is copied from it instead, keyed by the contents
+// of the clip. Returns whether it was copied from the cache.
+bool normalize_clip(const std::filesystem::path &video_file_path, const ClipProfile &clip_profile,
+                    const ClipProfile &profile, const std::filesystem::path &output_file_path,
+                    const std::string &video_extension, bool verbose = false, const ArtifactCache *cache = nullptr);
+// Overlays the image onto the video into output_path like overlay_image_to_video. If a cache is given, a segment whose
+// video and image were overlaid before is copied from it instead. Returns whether it was copied from the cache.
+bool overlay_segment(const std::filesystem::path &video_file_path, const std::filesystem::path &image_file_path,
+                     const std::filesystem::path &output_video_path, const std::string &video_extension,
+                     bool verbose = false, const ArtifactCache *cache = nullptr, std::size_t threads = 0);
+
+// Takes in a trajectory of Markov Chain states, and creates a filelist for ffmpeg to merge the videos together. The
+// states are streamed to the filelist, so memory use does not depend on the trajectory length. A run of k equal states
+// is written as one entry per set bit of k, naming the segment repeated that power of two times, so long runs take a
+// few lines instead of k. Returns the bit mask of the repeat counts used by each state, each of which
+// create_repeated_segment creates. The output path is filelist_path.
+std::vector<std::uint64_t> create_filelist(const MarkovTrajectory &markov_states,
+                                           const std::filesystem::path &filelist_path,
+                                           const std::string &overlay_name, const std::string &file_extension);
+// Creates a filelist showing the image of every state of the trajectory, named after the state followed by image_name,
+// for one frame of the image demuxer. A run of equal states is a single entry whose duration covers the whole run.
+void create_image_filelist(const MarkovTrajectory &markov_states, const std::filesystem::path &filelist_path,
+                           const std::string &image_name = ".png");
+// Creates the segment of state repeated repeat_count times, named like create_filelist names it, by stream copying its
+// overlaid segment.
+void create_repeated_segment(const std::filesystem::path &segments_folder_path, std::size_t state,
+                             std::uint64_t repeat_count, const std::string &overlay_name,
+                             const std::string &file_extension, bool verbose = false);
 // Takes in a filelist_path, reads from the filelist and uses the ffmpeg CLI to output a merged video to the output
 // location.
 void combine_segments(const std::filesystem::path &filelist_path, const std::filesystem::path &output,
                       bool verbose = false);
 
+// Frame rate and size of the GIF.
+struct GifOptions {
+  std::size_t fps = constants::DEFAULT_GIF_FPS;
+  // Width in pixels, the height follows from the aspect ratio of the graphs.
+  std::size_t width = constants::DEFAULT_GIF_WIDTH;
+};
+
+// Generates a single palette for the GIF from the PNGs of the given states in images_folder_path, scaled like the GIF
+// frames. If a cache is given, a palette made from the same images before is copied from it instead.
+void generate_gif_palette(const std::filesystem::path &images_folder_path, const std::vector<std::size_t> &states,
+                          const std::filesystem::path &palette_path, const GifOptions &options = {},
+                          bool verbose = false, const ArtifactCache *cache = nullptr);
+// Scales the PNG of the state and maps it onto the palette, writing an indexed PNG named after the state followed by
+// DEFAULT_GIF_FRAME_NAME. If a cache is given, a frame quantized before is copied from it instead. Returns whether it
+// was copied from the cache.
+bool quantize_gif_frame(const std::filesystem::path &images_folder_path, std::size_t state,
+                        const std::filesystem::path &palette_path, const GifOptions &options = {},
+                        bool verbose = false, const ArtifactCache *cache = nullptr);
+// Encodes the frames of the filelist into a GIF at the frame rate of options. The frames are expected to be indexed
+// already, so they are not quantized again, and the GIF encoder only stores the rectangle that changed between frames.
 void create_gif(const std::filesystem::path &filelist_path, const std::filesystem::path &output_gif_path,
-                bool verbose = false);
+                const GifOptions &options = {}, bool verbose = false);
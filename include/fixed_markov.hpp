@@ -0,0 +1,94 @@
+#pragma once
+
+#include "helpers.hpp"
+#include "markov.hpp"
+#include "transition_matrix.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// A transition matrix whose size is known at compile time. The constructor is constexpr and validates the matrix, so
+// declaring a constexpr FixedTransitionMatrix with an invalid matrix fails to compile.
+template <std::size_t N> class FixedTransitionMatrix {
+  static_assert(N > 0, "A Markov Chain needs at least one state.");
+
+public:
+  using Matrix = std::array<std::array<double, N>, N>;
+
+  constexpr FixedTransitionMatrix(const Matrix &probabilities) : probabilities(probabilities), thresholds() {
+    for (std::size_t i = 0; i < N; i++) {
+      double sum = constants::ZERO;
+      std::size_t last_positive = 0;
+      for (std::size_t j = 0; j < N; j++) {
+        if (probabilities[i][j] < constants::ZERO) {
+          throw std::invalid_argument("Transition matrix probabilities must be non-negative.");
+        }
+        if (probabilities[i][j] > constants::ZERO) {
+          last_positive = j;
+        }
+        sum += probabilities[i][j];
+        thresholds[i][j] = sum;
+      }
+      // Have to use this due to floating point arithmetic.
+      const double error = sum > constants::ONE ? sum - constants::ONE : constants::ONE - sum;
+      if (error > constants::EPSILON) {
+        throw std::invalid_argument("Transition probabilities must sum to 1.");
+      }
+      // Thresholds from the last possible state onwards can never be passed, even if the sum rounds to below 1.
+      for (std::size_t j = last_positive; j < N; j++) {
+        thresholds[i][j] = constants::ONE + constants::ONE;
+      }
+    }
+  }
+
+  // Returns the probability of moving from state i to state j.
+  constexpr double probability(std::size_t i, std::size_t j) const { return probabilities[i][j]; }
+  // Returns a view of the ith row.
+  TransitionRow row(std::size_t i) const { return {probabilities[i].data(), nullptr, N}; }
+
+  // Samples the state following state using a uniformly distributed value u in [0, 1). Counts the cumulative
+  // probabilities at or below u, which the compiler unrolls into a branch-free sum of comparisons.
+  constexpr std::size_t sample(std::size_t state, double u) const {
+    const std::array<double, N> &row_thresholds = thresholds[state];
+    std::size_t next = 0;
+    for (std::size_t j = 0; j + 1 < N; j++) {
+      next += static_cast<std::size_t>(u >= row_thresholds[j]);
+    }
+    return next;
+  }
+
+private:
+  Matrix probabilities;
+  // Cumulative probabilities of every row.
+  Matrix thresholds;
+};
+
+// A Markov Chain with N states and no heap allocations, for small chains that are known when building. It can be used
+// anywhere a MarkovModel is expected, such as iterate_markov_states and MarkovProcessor.
+template <std::size_t N> class FixedMarkovChain final : public MarkovModel {
+public:
+  FixedMarkovChain(const FixedTransitionMatrix<N> &transition_matrix) : transition_matrix(transition_matrix) {
+    for (std::size_t i = 0; i < N; i++) {
+      state_names[i] = std::to_string(i);
+    }
+  }
+  FixedMarkovChain(const FixedTransitionMatrix<N> &transition_matrix, const std::array<std::string, N> &state_names)
+      : transition_matrix(transition_matrix), state_names(state_names) {}
+
+  // Returns a read-only reference to the transitionMatrix.
+  const FixedTransitionMatrix<N> &get_transition_matrix() const { return transition_matrix; }
+  std::size_t get_transition_matrix_size() const override { return N; }
+  TransitionRow get_transition_row(std::size_t state) const override { return transition_matrix.row(state); }
+  std::string get_state_name(std::size_t state) const override { return state_names[state]; }
+
+protected:
+  std::uint64_t sample_context(std::uint64_t context, double u) const override {
+    return transition_matrix.sample(static_cast<std::size_t>(context), u);
+  }
+
+private:
+  FixedTransitionMatrix<N> transition_matrix;
+  std::array<std::string, N> state_names;
+};
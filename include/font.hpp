@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+namespace font {
+constexpr int GLYPH_WIDTH = 5;
+constexpr int GLYPH_HEIGHT = 7;
+// Horizontal distance between the starts of two glyphs.
+constexpr int GLYPH_ADVANCE = 6;
+
+// Returns the columns of the 5x7 glyph of c, left column first. Bit k of a column is row k from the top. Characters
+// outside printable ASCII map to '?'.
+const std::uint8_t *glyph(char c);
+} // namespace font
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "canvas.hpp"
+#include "markov.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Algorithms that place the states of a Markov Graph. Grid is the original three nodes per row layout, Force is a
+// force-directed layout with a Barnes-Hut approximation of the repulsion and Layered stacks the states in layers along
+// the direction of the transitions, which suits chains that rarely go back. Auto keeps the grid for small chains and
+// picks Layered for acyclic chains and Force otherwise.
+enum class LayoutAlgorithm { Auto, Grid, Force, Layered };
+
+struct LayoutOptions {
+  LayoutAlgorithm algorithm = LayoutAlgorithm::Auto;
+  // Transitions below this probability are not drawn.
+  double prune_threshold = 0.0;
+  // Routes edges between the same regions of the graph through shared control points, so they merge into bundles.
+  bool bundle_edges = false;
+};
+
+// How an edge is drawn. Left and Right bend by 30 degrees like TikZ's bend left and bend right, Loop is a self-loop
+// above the node and Bundled is a cubic curve through the edge's control points.
+enum class EdgeShape { Straight, Left, Right, Loop, Bundled };
+
+// Which side of an edge its probability label is on. Auto puts it on the left of the direction of travel.
+enum class LabelPlacement { Above, Below, Auto, None };
+
+struct LayoutEdge {
+  std::size_t from;
+  std::size_t to;
+  double probability;
+  EdgeShape shape;
+  LabelPlacement label;
+  // Control points of Bundled edges.
+  Point control_from;
+  Point control_to;
+};
+
+// Positions of the states in TikZ units (before the picture's scale, y pointing up) and the edges that are drawn. The
+// layout only depends on the chain, so it is computed once and shared by every highlighted variant.
+struct GraphLayout {
+  std::vector<Point> positions;
+  std::vector<LayoutEdge> edges;
+};
+
+// Computes the layout of the graph of the Markov Chain.
+GraphLayout compute_graph_layout(const MarkovModel &mc, const LayoutOptions &options = {});
+
+// Converts "auto", "grid", "force" or "layered" into a LayoutAlgorithm. Throws if the name is unknown.
+LayoutAlgorithm layout_algorithm_from_string(const std::string &name);
@@ -1,14 +1,42 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
-#include <sstream>
+#include <string>
 #include <string_view>
+#include <vector>
 
 // Namespace that contains constants.
 namespace constants {
 constexpr double EPSILON = 1e-9;
 constexpr double ZERO = 0.0;
 constexpr double ONE = 1.0;
+// Number of invalid rows listed when a transition matrix fails validation.
+constexpr std::size_t MAX_REPORTED_ROWS = 20;
+
+constexpr double ANALYSIS_TOLERANCE = 1e-12;
+constexpr std::size_t ANALYSIS_MAX_ITERATIONS = 100000;
+constexpr double MIXING_THRESHOLD = 0.25;
+constexpr std::size_t MIXING_SAMPLE_COUNT = 64;
+constexpr std::size_t MIXING_MAX_STEPS = 10000;
+// Bounds the multiply-adds of the mixing time estimate, so that large chains stop after fewer steps.
+constexpr std::size_t MIXING_MAX_WORK = std::size_t{1} << 31;
+// Matrices with fewer stored entries than this are processed on a single thread.
+constexpr std::size_t PARALLEL_MIN_ENTRIES = 1 << 16;
+constexpr std::size_t PARALLEL_ROW_BLOCK = 1024;
+// Resolution the graph PDFs are rasterized at.
+constexpr double DEFAULT_RASTER_DPI = 600.0;
+// Size limit of the artifact cache in MiB.
+constexpr std::size_t DEFAULT_CACHE_SIZE_MB = 2048;
+// How long the concat demuxer shows a PNG, the image demuxer's default of 25 frames per second.
+constexpr std::uint64_t DEFAULT_IMAGE_FRAME_MICROSECONDS = 40000;
+constexpr std::size_t DEFAULT_GIF_FPS = 10;
+constexpr std::size_t DEFAULT_GIF_WIDTH = 320;
+// How much of the standard error of a command is kept for its error report.
+constexpr std::size_t DEFAULT_ERROR_TAIL_BYTES = 4096;
+// Memory the libav video backend keeps overlaid frames in, in MiB.
+constexpr std::size_t DEFAULT_FRAME_CACHE_MB = 1024;
 
 constexpr std::string_view DEFAULT_VIDEO_OVERLAY_NAME = "_overlayed";
 constexpr std::string_view DEFAULT_VIDEO_EXTENSION = "mp4";
@@ -16,11 +44,22 @@ constexpr std::string_view DEFAULT_LATEX_COMPILER = "xelatex";
 constexpr std::string_view DEFAULT_LATEX_OUTPUT_DIRECTORY = "latex_build";
 constexpr std::string_view DEFAULT_FFMPEG_FILELIST = "filelist.txt";
 constexpr std::string_view DEFAULT_BUILD_DIRECTORY = "build_";
+constexpr std::string_view DEFAULT_LATEX_DOCUMENT_NAME = "graphs";
+constexpr std::string_view DEFAULT_OVERLAY_FILTER = "overlay=10:10";
+constexpr std::string_view DEFAULT_HIGHLIGHT_COLOR = "orange";
+constexpr std::string_view DEFAULT_GIF_PALETTE_NAME = "palette.png";
+// Suffix of the indexed PNGs the GIF is made of.
+constexpr std::string_view DEFAULT_GIF_FRAME_NAME = "_indexed.png";
+// Folder of the build directory that clips re-encoded to the canonical profile are written to.
+constexpr std::string_view DEFAULT_NORMALIZED_DIRECTORY = "normalized";
 
 constexpr std::string_view DEFAULT_LATEX_PREAMBLE =
     "\\documentclass[tikz, border=10pt]{standalone}\n"
     "\\usepackage{tikz}\n\\usetikzlibrary{automata, positioning}\n"
-    "\\begin{document}\n\\begin{tikzpicture}[scale=2]\n"
+    "\\begin{document}\n";
+// Every tikzpicture is a page of its own in the standalone class.
+constexpr std::string_view DEFAULT_LATEX_PICTURE_BEGIN =
+    "\\begin{tikzpicture}[scale=2]\n"
     "    \\tikzset{state/.style={draw, fill=white, circle, minimum size=1cm}}\n";
 } // namespace constants
 
@@ -28,10 +67,9 @@ constexpr std::string_view DEFAULT_LATEX_PREAMBLE =
 void create_dir(const std::filesystem::path &folder_path);
 // Deletes the directory or file at the specified path.
 void delete_dir_or_file(const std::filesystem::path &folder_path);
-// If verbose is true, appends to the command output so that the output is silenced. Implemented seperately for Windows.
-void check_verbosity(std::ostringstream &command, bool verbose);
-// Executes a command and throws if a problem is encountered. Modifies the verbosity.
-void execute_command(std::ostringstream &command, bool verbose);
+// Writes the pieces one after another into the file at file_path, replacing it. The pieces are handed to the OS in a
+// single gather write where the platform has one, so they never need to be copied into one buffer. Throws on failure.
+void write_file(const std::filesystem::path &file_path, const std::vector<std::string_view> &pieces);
 // Waits until the user presses enter.
 void wait_on_enter();
 // Returns current timestamp as "%Y%m%d_%H%M%S".
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "alias_table.hpp"
+#include "markov.hpp"
+#include "transition_matrix.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Open addressing hash table from packed contexts to the row that holds their transitions. Probing is linear over a
+// power of two sized table kept at most half full, so a lookup touches one or two cache lines.
+class ContextTable {
+public:
+  static constexpr std::size_t NOT_FOUND = std::numeric_limits<std::size_t>::max();
+
+  // Removes every context and sizes the table for count contexts.
+  void reset(std::size_t count);
+  // Maps context to row. Returns false if the context is already in the table.
+  bool insert(std::uint64_t context, std::size_t row);
+  // Returns the row of context, or NOT_FOUND if the context is not in the table.
+  std::size_t find(std::uint64_t context) const;
+
+  // Returns the number of contexts in the table.
+  std::size_t size() const;
+
+private:
+  static constexpr std::uint64_t EMPTY = std::numeric_limits<std::uint64_t>::max();
+
+  std::vector<std::uint64_t> keys;
+  std::vector<std::size_t> rows;
+  std::size_t mask = 0;
+  std::size_t count = 0;
+};
+
+// A Markov Chain whose next state depends on the last order states. Every context, the last order states packed as the
+// base N digits of a 64 bit value with the most recent state last, has its own row of transition probabilities over
+// the N states. Only contexts listed in the file are stored, so the chain may be much smaller than its N^order possible
+// contexts.
+//
+// The file format is the comma seperated format of first-order chains with every row prefixed by its context, e.g.
+// "0 1: 0.5, 0.5" for the row followed after states 0 and 1.
+//
+// To the visualizer the chain looks like a first-order chain over the N states, where the transitions out of state s
+// are the average of the rows of every context that ends in s.
+class HigherOrderMarkovChain : public MarkovModel {
+public:
+  HigherOrderMarkovChain(const std::filesystem::path &markov_file, const MatrixOptions &options = {});
+
+  // Returns the number of past states the next state depends on.
+  std::size_t get_order() const;
+  // Returns the number of contexts with their own transition probabilities.
+  std::size_t get_context_count() const;
+  // Returns the first-order projection of the chain used by get_transition_row.
+  const TransitionMatrix &get_projection() const;
+
+  // Returns the number of states of the Markov Chain.
+  std::size_t get_transition_matrix_size() const override;
+  // Returns a view of the projected transition probabilities out of state.
+  TransitionRow get_transition_row(std::size_t state) const override;
+  // Returns the name of state.
+  std::string get_state_name(std::size_t state) const override;
+  // Returns the most recent state of context.
+  std::size_t context_state(std::uint64_t context) const override;
+
+protected:
+  // Returns the first context in the file that ends in state. Throws if there is none.
+  std::uint64_t state_context(std::size_t state) const override;
+  // Looks up the row of context and samples the next state from its alias table.
+  std::uint64_t sample_context(std::uint64_t context, double u) const override;
+
+private:
+  std::size_t order;
+  std::size_t states;
+  // N^(order - 1), dropping the oldest state of a context is a modulo by this value.
+  std::uint64_t history_modulus;
+  // Row i holds the transitions of context row_contexts[i].
+  TransitionMatrix transitions;
+  std::vector<std::uint64_t> row_contexts;
+  ContextTable contexts;
+  AliasTable sampler;
+  TransitionMatrix projection;
+  // The context set_current_state uses for every state, EMPTY_CONTEXT if no context ends in the state.
+  std::vector<std::uint64_t> state_contexts;
+
+  static constexpr std::uint64_t EMPTY_CONTEXT = std::numeric_limits<std::uint64_t>::max();
+
+  // Packs the contexts read from the file and fills the context table.
+  void pack_contexts(const std::vector<std::uint32_t> &context_states);
+  // Validates the rows of every context and that every context a transition can lead to has its own row.
+  void validate_transitions() const;
+  // Builds the alias table of every context row.
+  void build_sampler();
+  // Averages the rows of the contexts ending in each state into the first-order projection.
+  void build_projection();
+};
+
+// Loads a first-order or higher-order Markov Chain from markov_file, depending on whether its rows start with contexts.
+std::unique_ptr<MarkovModel> load_markov_model(const std::filesystem::path &markov_file,
+                                               const MatrixOptions &options = {});
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Row kernels shared by the analytics and validation code. They use SSE2 when it is available and fall back to
+// unrolled scalar loops otherwise.
+
+// Returns the dot product of a and b.
+double dot_kernel(const double *a, const double *b, std::size_t count);
+// Returns the dot product of values and x gathered at columns.
+double gather_dot_kernel(const double *values, const std::uint32_t *columns, const double *x, std::size_t count);
+// Returns the sum of values.
+double sum_kernel(const double *values, std::size_t count);
+// Returns the smallest of values, or +infinity if count is zero.
+double min_kernel(const double *values, std::size_t count);
+// Returns the sum of values using Neumaier's compensated summation, which keeps the error independent of count.
+double compensated_sum_kernel(const double *values, std::size_t count);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "markov.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+// Returns whether markov-video was built with LIBAV=1, which encode_trajectory_video needs.
+bool libav_available();
+
+// Writes the video of the trajectory to output_path in a single process with libavformat, libavcodec and libavfilter.
+// The clip of every state the trajectory visits is decoded, the graph of the state is overlaid with
+// DEFAULT_OVERLAY_FILTER like overlay_image_to_video does, and the frames go straight into one encoder, so no overlaid
+// segments or filelist are written. The overlaid frames of a clip are kept in memory for later visits while they fit in
+// frame_cache_bytes, other clips are decoded again. Every clip is scaled to the size of the first one. Audio is not
+// carried over. Throws if markov-video was built without LIBAV=1.
+void encode_trajectory_video(const MarkovTrajectory &markov_states, const std::filesystem::path &videos_folder_path,
+                             const std::string &video_extension, const std::filesystem::path &images_folder_path,
+                             const std::filesystem::path &output_path, bool verbose = false,
+                             std::size_t frame_cache_bytes = 0);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+// A read-only memory mapping of a whole file. The mapping lives as long as the object.
+class MappedFile {
+public:
+  // How the mapped pages are going to be read, so that the kernel reads ahead only where it helps.
+  enum class Access { Sequential, Random };
+
+  explicit MappedFile(const std::filesystem::path &file_path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Returns the start of the mapped file. Returns nullptr for empty files.
+  const char *data() const;
+  // Returns the size of the mapped file in bytes.
+  std::size_t size() const;
+  // Tells the kernel how the pages are read from now on. New mappings are read sequentially. Does nothing on Windows.
+  void advise(Access access) const;
+
+private:
+  const char *mapped_data = nullptr;
+  std::size_t mapped_size = 0;
+#ifdef _WIN32
+  void *file_handle = nullptr;
+  void *mapping_handle = nullptr;
+#endif
+};
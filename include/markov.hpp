@@ -1,52 +1,119 @@
 #pragma once
 
+#include "alias_table.hpp"
+#include "transition_matrix.hpp"
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
-#include <random>
+#include <iterator>
 #include <string>
 #include <vector>
 
-class MarkovChain {
-public:
-  MarkovChain(const std::vector<std::vector<double>> &transition_matrix);
-  MarkovChain(const std::vector<std::vector<double>> &transition_matrix, const std::vector<std::string> &state_names);
+class MarkovTrajectory;
 
-  MarkovChain(const std::filesystem::path &markov_file);
-  MarkovChain(const std::filesystem::path &markov_file, const std::vector<std::string> &state_names);
+// Interface shared by every Markov Chain implementation. The model owns the current state and the counter-based random
+// numbers, implementations only describe their states and transitions.
+//
+// Internally a model moves between contexts, packed into 64 bits. For first-order chains the context is simply the
+// state, higher-order chains pack the last few states into it.
+class MarkovModel {
+public:
+  virtual ~MarkovModel() = default;
 
   // Sets the current state of the Markov Chain to the value provided.
   void set_current_state(std::size_t state);
   // Returns the currrent state of the Markov Chain.
   std::size_t get_current_state() const;
-  // Causes the Markov Chain to evolve in to the next state. The probabilities are decided based on the
-  // transitionMatrix.
+  // Causes the Markov Chain to evolve in to the next state.
   std::size_t next_state();
+  // Returns the context that follows context when using the random number at index of the given stream. Does not
+  // modify the Markov Chain.
+  std::uint64_t next_context(std::uint64_t context, std::uint64_t stream, std::uint64_t index) const;
+  // Returns the current context of the Markov Chain.
+  std::uint64_t get_current_context() const;
+  // Returns the state a context ends in.
+  virtual std::size_t context_state(std::uint64_t context) const;
+
+  // Returns the states that iterating the Markov Chain iterations times would produce, starting with the current state.
+  // The states are computed lazily and the Markov Chain is not modified.
+  MarkovTrajectory trajectory(std::size_t iterations) const;
+
+  // Seeds the random numbers of the Markov Chain. The chain is seeded from std::random_device on construction.
+  void set_seed(std::uint64_t seed);
+  // Returns the seed of the Markov Chain.
+  std::uint64_t get_seed() const;
+
+  // Returns the size of the Markov Chain.
+  virtual std::size_t get_transition_matrix_size() const = 0;
+  // Returns a view of the transition probabilities out of state.
+  virtual TransitionRow get_transition_row(std::size_t state) const = 0;
+  // Returns the name of state.
+  virtual std::string get_state_name(std::size_t state) const = 0;
+
+protected:
+  MarkovModel();
+
+  // Sets the current context of the Markov Chain.
+  void set_current_context(std::uint64_t context);
+  // Returns the context set_current_state uses for state.
+  virtual std::uint64_t state_context(std::size_t state) const;
+  // Samples the context that follows context using a uniformly distributed value u in [0, 1).
+  virtual std::uint64_t sample_context(std::uint64_t context, double u) const = 0;
+
+private:
+  std::uint64_t current_context;
+  // next_state() draws the random number at index step of stream 0 of the seed.
+  std::uint64_t seed;
+  std::uint64_t step;
+};
+
+class MarkovChain : public MarkovModel {
+public:
+  MarkovChain(const std::vector<std::vector<double>> &transition_matrix, const MatrixOptions &options = {});
+  MarkovChain(const std::vector<std::vector<double>> &transition_matrix, const std::vector<std::string> &state_names,
+              const MatrixOptions &options = {});
+
+  MarkovChain(const std::filesystem::path &markov_file, const MatrixOptions &options = {});
+  MarkovChain(const std::filesystem::path &markov_file, const std::vector<std::string> &state_names,
+              const MatrixOptions &options = {});
 
   // Returns a read-only reference to the transitionMatrix.
-  const std::vector<std::vector<double>> &get_transition_matrix() const;
+  const TransitionMatrix &get_transition_matrix() const;
   // Returns the size of the Markov Chain.
-  std::size_t get_transition_matrix_size() const;
+  std::size_t get_transition_matrix_size() const override;
+  // Returns a view of the ith row of the transitionMatrix.
+  TransitionRow get_transition_row(std::size_t state) const override;
   // Prints out the transitionMatrix with std::cout.
   void view_transition_matrix() const;
 
   // Returns a read-only reference to the stateNames.
   const std::vector<std::string> &get_state_names() const;
+  // Returns the name of state.
+  std::string get_state_name(std::size_t state) const override;
   // Prints out the stateNames with std::cout.
   void view_state_names() const;
 
+protected:
+  // Samples the next state in O(1) from the precomputed alias tables.
+  std::uint64_t sample_context(std::uint64_t context, double u) const override;
+
 private:
-  std::vector<std::vector<double>> transition_matrix;
+  TransitionMatrix transition_matrix;
   std::vector<std::string> state_names;
-  std::size_t current_state;
-  std::mt19937 generator;
+  AliasTable sampler;
 
   // Validates that the transitionMatrix follows the rules of a regular Markov Chain.
   // That is, the matrix is a square matrix, the probabilities in each row sum to 1.0, and the probabilities are
-  // non-negative.
+  // non-negative. Every offending row is listed in the exception.
   void validate_transition_matrix() const;
-  // Initializes the transitionMatrix of the Markov Chain from a file. The file must have the values of each row
-  // seperated by a comma. Function takes in the path to the file.
-  void transition_matrix_from_file(const std::filesystem::path &markov_file);
+  // Applies the options that have to run before validation.
+  void prepare_transition_matrix(const MatrixOptions &options);
+  // Builds the alias table of every row. Must be called after the transitionMatrix has been validated.
+  void build_sampler();
+  // Initializes the transitionMatrix of the Markov Chain from a file. The file must either be a binary matrix file or
+  // have the values of each row seperated by a comma. Function takes in the path to the file and the storage layout of
+  // the matrix.
+  void transition_matrix_from_file(const std::filesystem::path &markov_file, MatrixStorage storage);
 
   // Fills up the stateNames vector with linear values between 0 and N.
   void linear_state_names();
@@ -54,6 +121,64 @@ private:
   void validate_state_names() const;
 };
 
+// A lazily evaluated trajectory of a Markov Chain. States are computed on demand while iterating, so memory use does not
+// depend on the number of iterations. Iterating the same trajectory again yields the same states.
+class MarkovTrajectory {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::size_t *;
+    using reference = const std::size_t &;
+
+    iterator() = default;
+    iterator(const MarkovTrajectory *trajectory, std::uint64_t context);
+
+    reference operator*() const { return state; }
+    iterator &operator++();
+    iterator operator++(int);
+    bool operator==(const iterator &other) const;
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  private:
+    const MarkovTrajectory *trajectory = nullptr;
+    std::uint64_t context = 0;
+    std::size_t state = 0;
+    // Number of transitions taken so far.
+    std::size_t position = 0;
+    bool done = true;
+  };
+
+  // The trajectory starts at start_context and draws the random number of transition i from index first_index + i of
+  // the stream.
+  MarkovTrajectory(const MarkovModel &mc, std::uint64_t start_context, std::size_t iterations, std::uint64_t stream,
+                   std::uint64_t first_index);
+
+  iterator begin() const;
+  iterator end() const;
+
+  // Returns the number of transitions in the trajectory. The trajectory yields iterations + 1 states.
+  std::size_t get_iterations() const;
+  // Returns the distinct states of the trajectory in increasing order. Iterating stops as soon as every state of the
+  // Markov Chain was seen.
+  std::vector<std::size_t> visited_states() const;
+
+private:
+  const MarkovModel &mc;
+  std::uint64_t start_context;
+  std::size_t iterations;
+  std::uint64_t stream;
+  std::uint64_t first_index;
+};
+
 // Iterates the Markov Chain iterations times. Each state is written to an std::vector with values from std::size_t.
 // The starting value of the Markov Chain is included in the vector. Modifies original object.
-std::vector<std::size_t> iterate_markov_states(MarkovChain &mc, std::size_t iterations);
+std::vector<std::size_t> iterate_markov_states(MarkovModel &mc, std::size_t iterations);
+// Generates trajectory_count independent trajectories starting from the current state, each iterated iterations times,
+// using up to thread_count threads (0 meaning every hardware thread). Trajectory k draws its random numbers from stream
+// k of the seed, so the result only depends on the seed and not on the number of threads. Trajectory 0 is the same as
+// iterate_markov_states on a freshly seeded chain. Does not modify the Markov Chain.
+std::vector<std::vector<std::size_t>> iterate_markov_trajectories(const MarkovModel &mc, std::size_t trajectory_count,
+                                                                  std::size_t iterations, std::size_t thread_count = 0);
@@ -1,17 +1,35 @@
 #pragma once
 
+#include "artifact_cache.hpp"
+#include "ffmpeg.hpp"
+#include "graph_layout.hpp"
 #include "markov.hpp"
+#include "task_graph.hpp"
+#include "visuals.hpp"
 #include <cstddef>
 #include <filesystem>
 #include <string>
+#include <vector>
+
+// Backends that draw the graphs. Latex compiles them with a LaTeX compiler and ImageMagick, Native draws the PNGs
+// in-process.
+enum class GraphRenderer { Latex, Native };
+
+// Backends that make the video. Cli overlays every segment with an ffmpeg process and concatenates them, Libav decodes,
+// overlays and encodes the whole trajectory in-process.
+enum class VideoBackend { Cli, Libav };
 
 class MarkovProcessor {
 public:
-  MarkovProcessor(MarkovChain &mc, const std::filesystem::path &build_folder, const std::filesystem::path &output_path,
+  MarkovProcessor(MarkovModel &mc, const std::filesystem::path &build_folder, const std::filesystem::path &output_path,
                   const std::filesystem::path &latex_output_directory, const std::filesystem::path &filelist_path,
                   const std::string &file_extension, const std::string &overlay_extension,
                   const std::string &latex_compiler, const std::string &latex_compiler_options, bool edit_latex,
-                  bool verbose, bool no_cleanup);
+                  bool verbose, bool no_cleanup, std::size_t jobs = 0, bool single_document = false,
+                  GraphRenderer renderer = GraphRenderer::Latex, const ArtifactCache *cache = nullptr,
+                  const RasterOptions &raster_options = {}, const LayoutOptions &layout_options = {},
+                  std::size_t ffmpeg_threads = 0, VideoBackend video_backend = VideoBackend::Cli,
+                  const GifOptions &gif_options = {});
 
   void video(const std::filesystem::path &video_folder, std::size_t iterations) const;
 
@@ -22,7 +40,7 @@ public:
   void no_options() const;
 
 private:
-  MarkovChain &mc;
+  MarkovModel &mc;
   const std::filesystem::path &build_folder;
   const std::filesystem::path &output_path;
   const std::filesystem::path &latex_output_directory;
@@ -34,8 +52,38 @@ private:
   bool edit_latex;
   bool verbose;
   bool no_cleanup;
+  // Number of tasks, such as LaTeX compilers or ffmpeg overlays, run at once, 0 meaning every hardware thread.
+  std::size_t jobs;
+  // Threads of every ffmpeg overlay, 0 splitting the hardware threads between the jobs.
+  std::size_t ffmpeg_threads;
+  // Writes every graph as a page of one latex document, so that latex only runs once.
+  bool single_document;
+  GraphRenderer renderer;
+  // Persistent cache of graphs and overlaid segments, nullptr if caching is disabled.
+  const ArtifactCache *cache;
+  // Resolution of the PNGs rasterized from the LaTeX PDFs.
+  RasterOptions raster_options;
+  // How the states and edges of the graphs are placed.
+  LayoutOptions layout_options;
+  VideoBackend video_backend;
+  // Frame rate and size of GIFs.
+  GifOptions gif_options;
+
+  // Adds the tasks that draw the graph of every given state into png_output_path: writing, compiling and rasterizing
+  // its LaTeX file, or drawing it with the native renderer. Graphs found in the cache are copied right away instead.
+  // Returns the tasks after which the PNG of each state exists, in the order of states, empty for cached graphs.
+  std::vector<std::vector<TaskGraph::TaskId>> add_graph_tasks(TaskGraph &graph, const std::vector<std::size_t> &states,
+                                                              const std::filesystem::path &png_output_path) const;
+  // Returns the key of the graphs without the highlighted state, which is added per graph.
+  CacheKey graph_key() const;
 };
 
 enum class ProcessingMode { Video, GIF, BuildOnly };
 
 ProcessingMode determine_processing_mode(bool video_used, bool gif_used);
+
+// Converts "latex" or "native" into a GraphRenderer. Throws if the name is unknown.
+GraphRenderer graph_renderer_from_string(const std::string &name);
+
+// Converts "cli" or "libav" into a VideoBackend. Throws if the name is unknown.
+VideoBackend video_backend_from_string(const std::string &name);
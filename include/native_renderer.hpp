@@ -0,0 +1,29 @@
+#pragma once
+
+#include "canvas.hpp"
+#include "graph_layout.hpp"
+#include "markov.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+// Returns the color of one of the basic xcolor names ("orange", "red", ...) or of a "#rrggbb" code. Throws if the
+// name is unknown.
+Color color_from_name(const std::string &name);
+
+// Draws the highlighted graphs of a Markov Chain without running LaTeX or ImageMagick, with the same geometry as the
+// tikzpicture write_markov_graph writes for the layout. The curves are computed and the graph is drawn without a
+// highlight once, every state only redraws its own node onto a copy. render may be called from multiple threads.
+class NativeGraphRenderer {
+public:
+  NativeGraphRenderer(const MarkovModel &mc, const GraphLayout &layout, const std::string &highlight_color = "orange");
+  ~NativeGraphRenderer();
+
+  // Writes the graph with the node at highlight_index filled to png_path.
+  void render(std::size_t highlight_index, const std::filesystem::path &png_path) const;
+
+private:
+  struct Graph;
+  std::unique_ptr<const Graph> graph;
+};
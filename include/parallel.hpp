@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Returns the number of hardware threads, or 1 if it cannot be determined.
+inline std::size_t hardware_threads() { return std::max<std::size_t>(1, std::thread::hardware_concurrency()); }
+
+// How many jobs run at once and how many threads each of them may use.
+struct JobSchedule {
+  std::size_t jobs;
+  std::size_t threads_per_job;
+};
+
+// Splits the hardware threads between jobs that each run a multithreaded process, so that jobs * threads_per_job does
+// not exceed them. No more jobs than tasks or hardware threads run, 0 jobs meaning every hardware thread. A
+// threads_per_job of 0 gives every job an equal share of the hardware threads, otherwise the number of jobs is lowered
+// to fit. At least one job with one thread is always scheduled.
+inline JobSchedule schedule_jobs(std::size_t task_count, std::size_t jobs, std::size_t threads_per_job) {
+  const std::size_t cores = hardware_threads();
+  if (jobs == 0) {
+    jobs = cores;
+  }
+  jobs = std::max<std::size_t>(1, std::min({jobs, task_count, cores}));
+  if (threads_per_job == 0) {
+    threads_per_job = std::max<std::size_t>(1, cores / jobs);
+  } else {
+    jobs = std::max<std::size_t>(1, std::min(jobs, cores / threads_per_job));
+  }
+  return {jobs, threads_per_job};
+}
+
+// Calls task(i) for every i in [0, count) using up to thread_count threads, 0 meaning every hardware thread. Indices
+// are handed out one at a time, so tasks of uneven length balance themselves. The first exception thrown by a task is
+// rethrown once every thread has finished.
+template <typename Task> void parallel_for(std::size_t count, std::size_t thread_count, Task task) {
+  if (thread_count == 0) {
+    thread_count = hardware_threads();
+  }
+  thread_count = std::min(thread_count, count);
+
+  if (thread_count <= 1) {
+    for (std::size_t i = 0; i < count; i++) {
+      task(i);
+    }
+    return;
+  }
+
+  std::atomic<std::size_t> next_index{0};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&] {
+    for (std::size_t i = next_index++; i < count; i = next_index++) {
+      try {
+        task(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next_index = count;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(thread_count - 1);
+  for (std::size_t t = 1; t < thread_count; t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Philox4x32-10 counter-based random number generator, see Salmon et al. "Parallel Random Numbers: As Easy as 1, 2, 3"
+// (2011). Every output is a pure function of its counter and key, so streams can be split across threads without any
+// shared state.
+using PhiloxCounter = std::array<std::uint32_t, 4>;
+using PhiloxKey = std::array<std::uint32_t, 2>;
+
+// Returns the four random words belonging to counter under key.
+PhiloxCounter philox4x32(PhiloxCounter counter, PhiloxKey key);
+
+// Returns a uniformly distributed double in [0, 1) with 53 random bits. The value only depends on the seed, the stream
+// and the index inside the stream.
+double philox_uniform(std::uint64_t seed, std::uint64_t stream, std::uint64_t index);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "canvas.hpp"
+#include <filesystem>
+
+// Writes the canvas as an 8 bit RGB PNG. Throws if the file cannot be written.
+void write_png(const Canvas &canvas, const std::filesystem::path &png_path);
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A program followed by its arguments. The arguments reach the program as they are, no shell splits or expands them.
+using Command = std::vector<std::string>;
+
+// How a process is run.
+struct ProcessOptions {
+  // Shows the output of the process. Its standard error is kept for error reports either way.
+  bool verbose = false;
+  // Returns the standard output in ProcessResult::output instead of showing or discarding it.
+  bool capture_output = false;
+  // Kills the process after this long, 0 uses the default timeout of the executor.
+  std::chrono::milliseconds timeout{0};
+};
+
+struct ProcessResult {
+  // -1 if the process did not exit on its own.
+  int exit_code = 0;
+  bool timed_out = false;
+  bool cancelled = false;
+  std::string output;
+  // The end of the standard error, at most DEFAULT_ERROR_TAIL_BYTES long.
+  std::string error_tail;
+
+  bool succeeded() const { return exit_code == 0 && !timed_out && !cancelled; }
+};
+
+// Runs processes on a bounded number of worker threads. Processes are spawned directly with posix_spawn, and every
+// worker watches its process for output, its timeout and cancellation. Implemented with std::system on Windows, where
+// timeouts and cancellation are not supported.
+class ProcessExecutor {
+public:
+  // At most max_processes processes run at once, 0 meaning every hardware thread.
+  explicit ProcessExecutor(std::size_t max_processes = 0);
+  // Waits for the queued processes.
+  ~ProcessExecutor();
+  ProcessExecutor(const ProcessExecutor &) = delete;
+  ProcessExecutor &operator=(const ProcessExecutor &) = delete;
+
+  // The executor that execute_command runs every command of markov-video through.
+  static ProcessExecutor &global();
+
+  // Queues the command and returns at once. The future throws if the process cannot be started.
+  std::future<ProcessResult> submit(Command command, const ProcessOptions &options = {});
+  // Runs the command and waits for it. Throws with the end of its standard error if it fails.
+  ProcessResult run(const Command &command, const ProcessOptions &options = {});
+
+  void set_max_processes(std::size_t max_processes);
+  void set_default_timeout(std::chrono::milliseconds timeout);
+  // Kills the running processes, and every queued or later process fails as cancelled. Only sets a flag, so that it
+  // can be called from a signal handler.
+  void cancel() noexcept;
+  bool cancelled() const noexcept;
+
+private:
+  struct Task {
+    Command command;
+    ProcessOptions options;
+    std::promise<ProcessResult> promise;
+  };
+
+  void work();
+
+  std::mutex mutex;
+  std::condition_variable queue_changed;
+  std::deque<Task> queue;
+  std::vector<std::thread> workers;
+  std::size_t max_processes;
+  std::size_t running_count = 0;
+  std::size_t idle_count = 0;
+  bool stopping = false;
+  std::atomic<bool> cancel_requested{false};
+  std::atomic<std::chrono::milliseconds::rep> default_timeout{0};
+};
+
+// Formats the command for messages, quoting the arguments that contain spaces.
+std::string format_command(const Command &command);
+// Splits the options given as a single string on whitespace. Quotes are not interpreted.
+std::vector<std::string> split_arguments(const std::string &arguments);
+// Runs the command through the global executor. Throws with the end of its standard error if it fails.
+void execute_command(const Command &command, bool verbose);
+// Runs the command through the global executor and returns its standard output. Throws if it fails.
+std::string execute_command_output(const Command &command);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Tasks and the tasks each of them waits for. A task can only wait for tasks added before it, so the graph never has
+// a cycle.
+class TaskGraph {
+public:
+  using TaskId = std::size_t;
+
+  // Adds a task that runs once every dependency has finished. The name identifies it in error messages, e.g.
+  // "compile 3.tex". Throws if a dependency is not a task of the graph.
+  TaskId add(std::string name, std::function<void()> work, const std::vector<TaskId> &dependencies = {});
+
+  std::size_t size() const { return tasks.size(); }
+
+  // Runs every task on up to thread_count threads, 0 meaning every hardware thread. Every thread keeps the tasks it
+  // made ready in a queue of its own and runs the newest first, so a state's steps run one after another while other
+  // threads steal the oldest tasks of the busy ones. A failing task skips the tasks that depend on it without stopping
+  // the others, the failed tasks are listed in the exception thrown once no task can run anymore.
+  void run(std::size_t thread_count = 0);
+
+private:
+  struct Task {
+    std::string name;
+    std::function<void()> work;
+    std::vector<TaskId> dependents;
+    std::size_t dependency_count = 0;
+  };
+
+  std::vector<Task> tasks;
+};
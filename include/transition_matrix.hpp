@@ -0,0 +1,142 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Storage layouts of a TransitionMatrix. Auto picks whichever of the two layouts uses less memory.
+enum class MatrixStorage { Auto, Dense, Sparse };
+
+// Options for loading a transition matrix into a MarkovChain.
+struct MatrixOptions {
+  MatrixStorage storage = MatrixStorage::Auto;
+  // Rescales every row to sum to 1 before validation, which absorbs the rounding noise of exported data.
+  bool normalize = false;
+};
+
+// A row that breaks the rules of a regular Markov Chain.
+struct InvalidRow {
+  std::size_t row;
+  double sum;
+  bool has_negative;
+};
+
+// A read-only view of a single row of a TransitionMatrix. Only the first count entries of values are valid. For dense
+// rows columns is nullptr and values[k] belongs to column k.
+struct TransitionRow {
+  const double *values;
+  const std::uint32_t *columns;
+  std::size_t count;
+
+  // Returns the column that values[k] belongs to.
+  std::size_t column(std::size_t k) const { return columns ? columns[k] : k; }
+};
+
+// Contiguous storage for transition matrices. Small or dense chains are stored as a single row-major buffer, sparse
+// chains are stored in compressed sparse row (CSR) form so that only the non-zero probabilities take up memory. A
+// matrix can also be a zero-copy view of a memory mapped binary matrix file.
+class TransitionMatrix {
+public:
+  TransitionMatrix();
+  TransitionMatrix(const std::vector<std::vector<double>> &rows, MatrixStorage storage = MatrixStorage::Auto);
+
+  TransitionMatrix(const TransitionMatrix &other);
+  TransitionMatrix(TransitionMatrix &&other) noexcept;
+  TransitionMatrix &operator=(const TransitionMatrix &other);
+  TransitionMatrix &operator=(TransitionMatrix &&other) noexcept;
+
+  // Appends a row to the matrix. Every row must have the same length. Rows are kept in CSR form until finalize is
+  // called.
+  void append_row(const std::vector<double> &row);
+  // Appends a row given by its non-zero values and their ascending columns. width is the length of the full row.
+  void append_sparse_row(const std::vector<std::uint32_t> &row_columns, const std::vector<double> &row_values,
+                         std::size_t width);
+  // Converts the appended rows to their final layout.
+  void finalize(MatrixStorage storage);
+
+  // Returns the number of rows.
+  std::size_t size() const;
+  // Returns the number of columns.
+  std::size_t column_count() const;
+  // Returns the number of stored entries. For dense matrices this includes the zeros.
+  std::size_t stored_count() const;
+  // Returns true if the matrix is stored in CSR form.
+  bool is_sparse() const;
+
+  // Returns a view of the ith row.
+  TransitionRow row(std::size_t i) const;
+  // Returns the probability of moving from state i to state j.
+  double probability(std::size_t i, std::size_t j) const;
+
+  // Rescales every row with a positive sum so that it sums to 1, using compensated summation. Mapped matrices are
+  // copied into memory first.
+  void normalize_rows();
+
+  // Returns the transpose of the matrix in the same layout.
+  TransitionMatrix transposed() const;
+
+  // Returns a matrix that views the binary matrix file in mapping without copying it. Throws if the file is malformed.
+  static TransitionMatrix from_binary(std::shared_ptr<const MappedFile> mapping);
+  // Writes the matrix in the binary matrix format, keeping its current layout.
+  void write_binary(const std::filesystem::path &output_path) const;
+
+private:
+  std::size_t rows = 0;
+  std::size_t columns = 0;
+  bool sparse = true;
+
+  // Row-major values for dense matrices, the non-zero values of every row for sparse matrices.
+  std::vector<double> values;
+  // Column of every value and the offset of every row in values. Both are empty for dense matrices.
+  std::vector<std::uint32_t> column_indices;
+  std::vector<std::uint64_t> row_offsets;
+
+  // Where the matrix is read from. Either the vectors above, or the mapped binary file kept alive by mapping.
+  std::shared_ptr<const MappedFile> mapping;
+  const double *value_data = nullptr;
+  const std::uint32_t *column_data = nullptr;
+  const std::uint64_t *offset_data = nullptr;
+  std::size_t value_count = 0;
+
+  // Points the views at the owned vectors.
+  void bind();
+  // Copies a mapped matrix into the owned vectors so that it can be modified.
+  void detach();
+};
+
+// Checks every row in a single pass using up to thread_count threads, 0 meaning every hardware thread. Returns the rows
+// with a negative probability or a sum further than epsilon from 1, ordered by row.
+std::vector<InvalidRow> find_invalid_rows(const TransitionMatrix &transition_matrix, double epsilon,
+                                          std::size_t thread_count = 0);
+
+// Throws std::invalid_argument listing the rows find_invalid_rows reports, if there are any.
+void throw_if_invalid_rows(const TransitionMatrix &transition_matrix, double epsilon);
+
+// Reads a transition matrix from a file. Binary matrix files are detected by their header and mapped without copying,
+// anything else is parsed as text with the values of each row seperated by a comma. Text parse errors report the line
+// and column of the offending value.
+TransitionMatrix read_transition_matrix(const std::filesystem::path &markov_file,
+                                        MatrixStorage storage = MatrixStorage::Auto);
+
+// The transitions of a higher-order chain, read from text lines of the form "c1 c2 ... ck: p0, p1, ...". Row i of
+// transitions holds the probabilities that follow the context stored in contexts[i * order] to
+// contexts[(i + 1) * order - 1], oldest state first.
+struct ContextMatrix {
+  std::size_t order;
+  std::vector<std::uint32_t> contexts;
+  TransitionMatrix transitions;
+};
+
+// Reads the transitions of a higher-order chain from a text file.
+ContextMatrix read_context_matrix(const std::filesystem::path &markov_file,
+                                  MatrixStorage storage = MatrixStorage::Sparse);
+// Returns true if the file is a text file whose first line starts with a context, that is, if it holds a higher-order
+// chain.
+bool is_context_matrix_file(const std::filesystem::path &markov_file);
+
+// Converts "auto", "dense" or "sparse" into a MatrixStorage. Throws if the name is unknown.
+MatrixStorage matrix_storage_from_string(const std::string &name);
@@ -1,27 +1,66 @@
 #pragma once
 
+#include "graph_layout.hpp"
+#include "helpers.hpp"
 #include "markov.hpp"
 #include <cstddef>
 #include <filesystem>
+#include <ostream>
 #include <string>
+#include <vector>
 
+// The tikzpicture of a Markov Chain, formatted once with no node highlighted. A highlighted variant is the same text
+// with the fill option spliced into one node, so writing it copies the shared body without formatting anything.
+class MarkovGraphPicture {
+public:
+  MarkovGraphPicture(const MarkovModel &mc, const GraphLayout &layout);
+
+  // Writes the picture with the node at highlight_index filled. No node is filled if the index is out of range.
+  void write(std::ostream &markov_graph_latex, std::size_t highlight_index,
+             const std::string &highlight_color = "orange") const;
+  // Writes a standalone latex file containing the picture with the node at highlight_index filled.
+  void write_document(const std::filesystem::path &latex_file_output_path, std::size_t highlight_index,
+                      const std::string &highlight_color = "orange") const;
+
+private:
+  std::string body;
+  // Offset in body of each node's option list, where the fill option is inserted.
+  std::vector<std::size_t> fill_offsets;
+};
+
+// Writes the tikzpicture of the Markov Chain drawn with layout, with the node at highlight_index filled, to
+// markov_graph_latex.
+void write_markov_graph(std::ostream &markov_graph_latex, const MarkovModel &mc, const GraphLayout &layout,
+                        std::size_t highlight_index, const std::string &highlight_color = "orange");
 // Generates a latex file in the latex_file_output_path based on the Markov Chain provided.
-void generate_markov_graph(const MarkovChain &mc, const std::filesystem::path &latex_file_output_path,
-                           std::size_t highlight_index, const std::string &highlight_color = "orange");
-// Generates multiple latex files in the specified path with each of the files highlighting a single node.
-void generate_all_markov_graphs(const MarkovChain &mc, const std::filesystem::path &latex_files_output_folder);
+void generate_markov_graph(const MarkovModel &mc, const GraphLayout &layout,
+                           const std::filesystem::path &latex_file_output_path, std::size_t highlight_index,
+                           const std::string &highlight_color = "orange");
+// Generates a single latex file whose page i highlights node i, so that every graph is compiled by one latex run.
+void generate_markov_graph_document(const MarkovModel &mc, const GraphLayout &layout,
+                                    const std::filesystem::path &latex_file_output_path,
+                                    const std::string &highlight_color = "orange");
 
 // Compiles the Markov Graph using the specified latex compiler.
 void compile_markov_graph(const std::filesystem::path &folder_path, const std::filesystem::path &file_name,
                           const std::filesystem::path &latex_output_directory, const std::string &latex_compiler,
                           const std::string &latex_compiler_options, bool verbose);
-// Compiles the Markov Graphs in a specified folder.
-void compile_all_markov_graphs(const std::filesystem::path &latex_folder_path, std::size_t file_count,
-                               const std::filesystem::path &latex_output_directory, const std::string &latex_compiler,
-                               const std::string &latex_compiler_options, bool verbose = false);
-// Converts the specified PDF into a PNG using ImageMagick.
+// Compiles the file named after index in latex_folder_path in a directory of its own under latex_output_directory, so
+// that parallel runs never share aux or log files, and moves the PDF up into latex_output_directory. A failed run keeps
+// its directory for the log.
+void compile_markov_graph_isolated(const std::filesystem::path &latex_folder_path, std::size_t index,
+                                   const std::filesystem::path &latex_output_directory,
+                                   const std::string &latex_compiler, const std::string &latex_compiler_options,
+                                   bool verbose);
+// Resolution of the PNGs rasterized from the graph PDFs.
+struct RasterOptions {
+  // Pixels per inch of the PDF page.
+  double dpi = constants::DEFAULT_RASTER_DPI;
+  // Width of the PNG in pixels, chosen over dpi unless it is 0. The height follows from the page's aspect ratio.
+  std::size_t width = 0;
+};
+
+// Rasterizes page page_index of the specified PDF into a PNG. Uses poppler in-process when built with POPPLER=1, the
+// ImageMagick CLI otherwise.
 void convert_pdf_to_png(const std::filesystem::path &pdf_file_path, const std::filesystem::path &output_png_path,
-                        bool verbose);
-// Converts the PDFs in the specified folder using an index up to file_count to PNGs in the output_path.
-void convert_all_pdfs_to_pngs(const std::filesystem::path &folder_path, std::size_t file_count,
-                              const std::filesystem::path &output_path, bool verbose = false);
+                        const RasterOptions &options, bool verbose, std::size_t page_index = 0);
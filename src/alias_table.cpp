@@ -0,0 +1,78 @@
+// Vose's alias method, see "A Linear Algorithm For Generating Random Numbers With a Given Distribution" (1991).
+
+#include "alias_table.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+void AliasTable::add_row(const double *weights, const std::uint32_t *columns, std::size_t count) {
+  std::vector<std::uint32_t> row_outcomes;
+  std::vector<double> scaled;
+  double sum = 0.0;
+
+  for (std::size_t k = 0; k < count; k++) {
+    if (weights[k] > 0.0) {
+      row_outcomes.push_back(columns ? columns[k] : static_cast<std::uint32_t>(k));
+      scaled.push_back(weights[k]);
+      sum += weights[k];
+    }
+  }
+
+  const std::size_t slots = scaled.size();
+  if (slots == 0) {
+    throw std::invalid_argument("Cannot build an alias table for a row without positive probabilities.");
+  }
+
+  std::vector<std::size_t> small;
+  std::vector<std::size_t> large;
+  for (std::size_t k = 0; k < slots; k++) {
+    scaled[k] *= static_cast<double>(slots) / sum;
+    (scaled[k] < 1.0 ? small : large).push_back(k);
+  }
+
+  const std::size_t offset = row_offsets.back();
+  probabilities.resize(offset + slots, 1.0);
+  outcomes.insert(outcomes.end(), row_outcomes.begin(), row_outcomes.end());
+  aliases.insert(aliases.end(), row_outcomes.begin(), row_outcomes.end());
+
+  while (!small.empty() && !large.empty()) {
+    const std::size_t less = small.back();
+    const std::size_t more = large.back();
+    small.pop_back();
+
+    probabilities[offset + less] = scaled[less];
+    aliases[offset + less] = row_outcomes[more];
+
+    scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+    if (scaled[more] < 1.0) {
+      large.pop_back();
+      small.push_back(more);
+    }
+  }
+  // Whatever is left over only differs from 1.0 due to rounding, and keeps the default probability of 1.0.
+
+  row_offsets.push_back(offset + slots);
+}
+
+std::size_t AliasTable::sample(std::size_t row, double u) const {
+  const std::size_t offset = row_offsets[row];
+  const std::size_t slots = row_offsets[row + 1] - offset;
+
+  // A single uniform value picks both the slot and the coin flip inside the slot.
+  const double scaled = u * static_cast<double>(slots);
+  const std::size_t slot = std::min(static_cast<std::size_t>(scaled), slots - 1);
+  const double coin = scaled - static_cast<double>(slot);
+
+  return coin < probabilities[offset + slot] ? outcomes[offset + slot] : aliases[offset + slot];
+}
+
+std::size_t AliasTable::size() const { return row_offsets.size() - 1; }
+
+void AliasTable::clear() {
+  row_offsets.assign(1, 0);
+  probabilities.clear();
+  outcomes.clear();
+  aliases.clear();
+}
@@ -0,0 +1,474 @@
+#include "analytics.hpp"
+#include "helpers.hpp"
+#include "kernels.hpp"
+#include "markov.hpp"
+#include "parallel.hpp"
+#include "transition_matrix.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+double l1_distance(const std::vector<double> &a, const std::vector<double> &b) {
+  double distance = 0.0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    distance += std::fabs(a[i] - b[i]);
+  }
+  return distance;
+}
+
+// Marks every state that can reach one of the marked states, following edges backwards through the transpose. States
+// in blocked are never expanded.
+void mark_predecessors(const TransitionMatrix &transpose, std::vector<bool> &marked, const std::vector<bool> &blocked) {
+  std::vector<std::size_t> stack;
+  for (std::size_t i = 0; i < marked.size(); i++) {
+    if (marked[i]) {
+      stack.push_back(i);
+    }
+  }
+  while (!stack.empty()) {
+    const std::size_t state = stack.back();
+    stack.pop_back();
+    const TransitionRow row = transpose.row(state);
+    for (std::size_t k = 0; k < row.count; k++) {
+      const std::size_t previous = row.column(k);
+      if (row.values[k] > 0.0 && !marked[previous] && !blocked[previous]) {
+        marked[previous] = true;
+        stack.push_back(previous);
+      }
+    }
+  }
+}
+
+// Numbers every state with its strongly connected component, following the transitions with a positive probability,
+// with an iterative version of Tarjan's algorithm. Sets component_count to the number of components.
+std::vector<std::size_t> strongly_connected_components(const TransitionMatrix &matrix, std::size_t &component_count) {
+  constexpr std::size_t UNVISITED = std::numeric_limits<std::size_t>::max();
+  const std::size_t n = matrix.size();
+  std::vector<std::size_t> index(n, UNVISITED);
+  std::vector<std::size_t> low(n);
+  std::vector<std::size_t> component(n, UNVISITED);
+  std::vector<std::size_t> stack;
+  // The states whose transitions are being followed, each with the position of its next transition.
+  std::vector<std::pair<std::size_t, std::size_t>> calls;
+  std::size_t next_index = 0;
+  component_count = 0;
+
+  auto visit = [&](std::size_t state) {
+    index[state] = low[state] = next_index++;
+    stack.push_back(state);
+    calls.emplace_back(state, 0);
+  };
+  for (std::size_t root = 0; root < n; root++) {
+    if (index[root] != UNVISITED) {
+      continue;
+    }
+    visit(root);
+    while (!calls.empty()) {
+      const std::size_t state = calls.back().first;
+      const TransitionRow row = matrix.row(state);
+      const std::size_t k = calls.back().second++;
+      if (k < row.count) {
+        const std::size_t next = row.column(k);
+        if (row.values[k] <= 0.0) {
+          continue;
+        }
+        if (index[next] == UNVISITED)
+          visit(next);
+        else if (component[next] == UNVISITED)
+          low[state] = std::min(low[state], index[next]);
+        continue;
+      }
+
+      calls.pop_back();
+      if (!calls.empty()) {
+        const std::size_t parent = calls.back().first;
+        low[parent] = std::min(low[parent], low[state]);
+      }
+      if (low[state] == index[state]) {
+        std::size_t member;
+        do {
+          member = stack.back();
+          stack.pop_back();
+          component[member] = component_count;
+        } while (member != state);
+        component_count++;
+      }
+    }
+  }
+  return component;
+}
+
+void write_json_array(std::ostream &output, const std::vector<double> &values) {
+  output << "[";
+  for (std::size_t i = 0; i < values.size(); i++) {
+    if (i > 0) {
+      output << ", ";
+    }
+    if (std::isfinite(values[i])) {
+      output << values[i];
+    } else {
+      output << "null";
+    }
+  }
+  output << "]";
+}
+
+// Escapes text for a JSON string. Control characters have no literal form in JSON, so they are written as escapes.
+std::string json_escape(const std::string &text) {
+  constexpr char HEX_DIGITS[] = "0123456789abcdef";
+  std::string escaped;
+  for (char c : text) {
+    switch (c) {
+    case '"':
+      escaped += "\\\"";
+      break;
+    case '\\':
+      escaped += "\\\\";
+      break;
+    case '\b':
+      escaped += "\\b";
+      break;
+    case '\f':
+      escaped += "\\f";
+      break;
+    case '\n':
+      escaped += "\\n";
+      break;
+    case '\r':
+      escaped += "\\r";
+      break;
+    case '\t':
+      escaped += "\\t";
+      break;
+    default: {
+      const unsigned char code = static_cast<unsigned char>(c);
+      if (code < 0x20) {
+        escaped += "\\u00";
+        escaped += HEX_DIGITS[code >> 4];
+        escaped += HEX_DIGITS[code & 0xf];
+      } else {
+        escaped += c;
+      }
+    }
+    }
+  }
+  return escaped;
+}
+} // namespace
+
+MarkovAnalyzer::MarkovAnalyzer(const TransitionMatrix &transition_matrix, std::size_t thread_count)
+    : transition_matrix(transition_matrix), transpose(transition_matrix.transposed()),
+      thread_count(transition_matrix.stored_count() < constants::PARALLEL_MIN_ENTRIES ? 1 : thread_count) {}
+
+void MarkovAnalyzer::multiply(const TransitionMatrix &matrix, const std::vector<double> &x,
+                              std::vector<double> &result) const {
+  const std::size_t rows = matrix.size();
+  const std::size_t blocks = (rows + constants::PARALLEL_ROW_BLOCK - 1) / constants::PARALLEL_ROW_BLOCK;
+  result.resize(rows);
+
+  parallel_for(blocks, thread_count, [&](std::size_t block) {
+    const std::size_t first = block * constants::PARALLEL_ROW_BLOCK;
+    const std::size_t last = std::min(rows, first + constants::PARALLEL_ROW_BLOCK);
+    for (std::size_t i = first; i < last; i++) {
+      const TransitionRow row = matrix.row(i);
+      result[i] = row.columns ? gather_dot_kernel(row.values, row.columns, x.data(), row.count)
+                              : dot_kernel(row.values, x.data(), row.count);
+    }
+  });
+}
+
+std::vector<double> MarkovAnalyzer::step_distribution(const std::vector<double> &distribution) const {
+  std::vector<double> result;
+  multiply(transpose, distribution, result);
+  return result;
+}
+
+std::vector<double> MarkovAnalyzer::step_expectation(const std::vector<double> &values) const {
+  std::vector<double> result;
+  multiply(transition_matrix, values, result);
+  return result;
+}
+
+std::vector<double> MarkovAnalyzer::stationary_distribution(double tolerance, std::size_t max_iterations,
+                                                            std::size_t &iterations_used, bool &converged) const {
+  const std::size_t n = transition_matrix.size();
+  std::vector<double> distribution(n, constants::ONE / static_cast<double>(n));
+  std::vector<double> next;
+
+  double change = std::numeric_limits<double>::infinity();
+  for (iterations_used = 0; iterations_used < max_iterations && !(change < tolerance); iterations_used++) {
+    multiply(transpose, distribution, next);
+    for (std::size_t i = 0; i < n; i++) {
+      next[i] = 0.5 * (next[i] + distribution[i]);
+    }
+    change = l1_distance(next, distribution);
+    distribution.swap(next);
+  }
+  // The residual decides, so that converging on the last allowed iteration still counts.
+  converged = change < tolerance;
+  return distribution;
+}
+
+std::vector<double> MarkovAnalyzer::n_step_distribution(std::size_t start_state, std::size_t n) const {
+  if (start_state >= transition_matrix.size()) {
+    throw std::out_of_range("State index out of range.");
+  }
+  std::vector<double> distribution(transition_matrix.size(), constants::ZERO);
+  std::vector<double> next;
+  distribution[start_state] = constants::ONE;
+
+  for (std::size_t i = 0; i < n; i++) {
+    multiply(transpose, distribution, next);
+    distribution.swap(next);
+  }
+  return distribution;
+}
+
+std::vector<double> MarkovAnalyzer::expected_hitting_times(std::size_t target_state, double tolerance,
+                                                           std::size_t max_iterations, std::size_t &iterations_used,
+                                                           bool &converged) const {
+  const std::size_t n = transition_matrix.size();
+  if (target_state >= n) {
+    throw std::out_of_range("State index out of range.");
+  }
+
+  // A state has an infinite hitting time if it can get to a state that never reaches the target without passing
+  // through the target first.
+  std::vector<bool> reaches_target(n, false);
+  reaches_target[target_state] = true;
+  mark_predecessors(transpose, reaches_target, std::vector<bool>(n, false));
+
+  std::vector<bool> infinite(n, false);
+  for (std::size_t i = 0; i < n; i++) {
+    infinite[i] = !reaches_target[i];
+  }
+  std::vector<bool> blocked(n, false);
+  blocked[target_state] = true;
+  mark_predecessors(transpose, infinite, blocked);
+
+  // Value iteration of h = 1 + P h with h(target) = 0. Finite states never move to infinite ones, so those can be
+  // left at zero while iterating.
+  std::vector<double> hitting_times(n, constants::ZERO);
+  std::vector<double> next;
+  double change = std::numeric_limits<double>::infinity();
+  for (iterations_used = 0; iterations_used < max_iterations && !(change < tolerance); iterations_used++) {
+    multiply(transition_matrix, hitting_times, next);
+    change = 0.0;
+    for (std::size_t i = 0; i < n; i++) {
+      next[i] = (i == target_state || infinite[i]) ? constants::ZERO : constants::ONE + next[i];
+      change = std::max(change, std::fabs(next[i] - hitting_times[i]) / std::max(constants::ONE, next[i]));
+    }
+    hitting_times.swap(next);
+  }
+  converged = change < tolerance;
+
+  for (std::size_t i = 0; i < n; i++) {
+    if (infinite[i]) {
+      hitting_times[i] = std::numeric_limits<double>::infinity();
+    }
+  }
+  return hitting_times;
+}
+
+bool MarkovAnalyzer::mixes() const {
+  const std::size_t n = transition_matrix.size();
+  std::size_t component_count = 0;
+  const std::vector<std::size_t> component = strongly_connected_components(transition_matrix, component_count);
+
+  // A closed component has no transition out of it. Starts in different closed components never meet.
+  std::vector<bool> closed(component_count, true);
+  for (std::size_t i = 0; i < n; i++) {
+    const TransitionRow row = transition_matrix.row(i);
+    for (std::size_t k = 0; k < row.count; k++) {
+      if (row.values[k] > 0.0 && component[row.column(k)] != component[i])
+        closed[component[i]] = false;
+    }
+  }
+  if (std::count(closed.begin(), closed.end(), true) != 1) {
+    return false;
+  }
+  const std::size_t recurrent =
+      static_cast<std::size_t>(std::find(closed.begin(), closed.end(), true) - closed.begin());
+
+  // The period of the closed component is the gcd of level(u) + 1 - level(v) over its transitions u -> v, with the
+  // levels of a breadth-first search. A periodic chain keeps cycling and never mixes.
+  constexpr std::size_t UNVISITED = std::numeric_limits<std::size_t>::max();
+  std::vector<std::size_t> level(n, UNVISITED);
+  const std::size_t root = static_cast<std::size_t>(std::find(component.begin(), component.end(), recurrent) -
+                                                    component.begin());
+  std::vector<std::size_t> queue = {root};
+  level[root] = 0;
+  std::size_t period = 0;
+  for (std::size_t head = 0; head < queue.size(); head++) {
+    const std::size_t state = queue[head];
+    const TransitionRow row = transition_matrix.row(state);
+    for (std::size_t k = 0; k < row.count; k++) {
+      const std::size_t next = row.column(k);
+      if (row.values[k] <= 0.0) {
+        continue;
+      }
+      if (level[next] == UNVISITED) {
+        level[next] = level[state] + 1;
+        queue.push_back(next);
+      } else {
+        const std::size_t a = level[state] + 1;
+        const std::size_t b = level[next];
+        period = std::gcd(period, a > b ? a - b : b - a);
+      }
+    }
+  }
+  return period == 1;
+}
+
+std::size_t MarkovAnalyzer::mixing_step_limit(std::size_t sample_count, std::size_t max_steps) const {
+  const std::size_t starts = std::min(transition_matrix.size(), sample_count);
+  // Every step multiplies each start's distribution with the matrix once.
+  const std::size_t step_work = std::max<std::size_t>(1, starts * transition_matrix.stored_count());
+  return std::min(max_steps, std::max<std::size_t>(1, constants::MIXING_MAX_WORK / step_work));
+}
+
+std::optional<std::size_t> MarkovAnalyzer::mixing_time(const std::vector<double> &stationary, double threshold,
+                                                       std::size_t sample_count, std::size_t max_steps) const {
+  const std::size_t n = transition_matrix.size();
+  const std::size_t starts = std::min(n, sample_count);
+  max_steps = mixing_step_limit(sample_count, max_steps);
+
+  std::vector<std::vector<double>> distributions(starts, std::vector<double>(n, constants::ZERO));
+  for (std::size_t s = 0; s < starts; s++) {
+    distributions[s][s * n / starts] = constants::ONE;
+  }
+
+  std::vector<double> next;
+  for (std::size_t t = 0; t <= max_steps; t++) {
+    bool mixed = true;
+    for (const auto &distribution : distributions) {
+      if (0.5 * l1_distance(distribution, stationary) > threshold) {
+        mixed = false;
+        break;
+      }
+    }
+    if (mixed) {
+      return t;
+    }
+
+    for (auto &distribution : distributions) {
+      multiply(transpose, distribution, next);
+      distribution.swap(next);
+    }
+  }
+  return std::nullopt;
+}
+
+MarkovAnalysis analyze_markov_chain(const MarkovChain &mc, std::size_t n_steps, std::size_t hitting_target,
+                                    std::size_t thread_count) {
+  if (hitting_target >= mc.get_transition_matrix_size()) {
+    throw std::invalid_argument("Hitting target " + std::to_string(hitting_target) + " is not a state of the chain, " +
+                                "which has " + std::to_string(mc.get_transition_matrix_size()) + " states.");
+  }
+  const MarkovAnalyzer analyzer(mc.get_transition_matrix(), thread_count);
+  MarkovAnalysis analysis;
+
+  analysis.stationary =
+      analyzer.stationary_distribution(constants::ANALYSIS_TOLERANCE, constants::ANALYSIS_MAX_ITERATIONS,
+                                       analysis.stationary_iterations, analysis.stationary_converged);
+  analysis.start_state = mc.get_current_state();
+  analysis.n_steps = n_steps;
+  analysis.n_step = analyzer.n_step_distribution(analysis.start_state, n_steps);
+  analysis.hitting_target = hitting_target;
+  analysis.hitting_times =
+      analyzer.expected_hitting_times(hitting_target, constants::ANALYSIS_TOLERANCE, constants::ANALYSIS_MAX_ITERATIONS,
+                                      analysis.hitting_iterations, analysis.hitting_converged);
+  analysis.mixing_threshold = constants::MIXING_THRESHOLD;
+  analysis.mixes = analyzer.mixes();
+  analysis.mixing_max_steps = analyzer.mixing_step_limit(constants::MIXING_SAMPLE_COUNT, constants::MIXING_MAX_STEPS);
+  if (analysis.mixes) {
+    analysis.mixing_time = analyzer.mixing_time(analysis.stationary, constants::MIXING_THRESHOLD,
+                                                constants::MIXING_SAMPLE_COUNT, constants::MIXING_MAX_STEPS);
+  }
+  return analysis;
+}
+
+void print_markov_analysis(const MarkovAnalysis &analysis, const MarkovChain &mc, std::ostream &output) {
+  const std::vector<std::string> &state_names = mc.get_state_names();
+
+  output << "Stationary distribution "
+         << (analysis.stationary_converged ? "converged after " : "did not converge after ")
+         << analysis.stationary_iterations << " iterations." << std::endl;
+  output << "Hitting times " << (analysis.hitting_converged ? "converged after " : "did not converge after ")
+         << analysis.hitting_iterations << " iterations." << std::endl;
+  if (analysis.mixing_time) {
+    output << "Estimated mixing time (TV <= " << analysis.mixing_threshold << "): " << *analysis.mixing_time
+           << " steps." << std::endl;
+  } else if (!analysis.mixes) {
+    output << "The chain never mixes, it is periodic or has more than one closed class." << std::endl;
+  } else {
+    output << "The chain did not mix within " << analysis.mixing_max_steps << " steps." << std::endl;
+  }
+
+  output << std::left << std::setw(16) << "state" << std::right << std::setw(16) << "stationary" << std::setw(16)
+         << "return time" << std::setw(16) << (std::to_string(analysis.n_steps) + "-step") << std::setw(16)
+         << ("hit " + state_names[analysis.hitting_target]) << std::endl;
+
+  for (std::size_t i = 0; i < analysis.stationary.size(); i++) {
+    const double return_time = analysis.stationary[i] > 0.0 ? 1.0 / analysis.stationary[i]
+                                                            : std::numeric_limits<double>::infinity();
+    output << std::left << std::setw(16) << state_names[i] << std::right << std::setprecision(6) << std::setw(16)
+           << analysis.stationary[i] << std::setw(16) << return_time << std::setw(16) << analysis.n_step[i]
+           << std::setw(16) << analysis.hitting_times[i] << std::endl;
+  }
+}
+
+void write_markov_analysis_json(const MarkovAnalysis &analysis, const MarkovChain &mc, const fs::path &output_path) {
+  std::ofstream output(output_path);
+  if (!output.is_open()) {
+    throw std::runtime_error("Cannot open file: " + output_path.string());
+  }
+  output << std::setprecision(17);
+
+  output << "{\n  \"states\": [";
+  const std::vector<std::string> &state_names = mc.get_state_names();
+  for (std::size_t i = 0; i < state_names.size(); i++) {
+    output << (i > 0 ? ", " : "") << "\"" << json_escape(state_names[i]) << "\"";
+  }
+  output << "],\n";
+
+  output << "  \"stationary\": {\"converged\": " << (analysis.stationary_converged ? "true" : "false")
+         << ", \"iterations\": " << analysis.stationary_iterations << ", \"distribution\": ";
+  write_json_array(output, analysis.stationary);
+  output << "},\n";
+
+  output << "  \"n_step\": {\"start_state\": " << analysis.start_state << ", \"steps\": " << analysis.n_steps
+         << ", \"distribution\": ";
+  write_json_array(output, analysis.n_step);
+  output << "},\n";
+
+  output << "  \"hitting_times\": {\"target_state\": " << analysis.hitting_target
+         << ", \"converged\": " << (analysis.hitting_converged ? "true" : "false")
+         << ", \"iterations\": " << analysis.hitting_iterations << ", \"expected_steps\": ";
+  write_json_array(output, analysis.hitting_times);
+  output << "},\n";
+
+  output << "  \"mixing_time\": {\"threshold\": " << analysis.mixing_threshold
+         << ", \"mixes\": " << (analysis.mixes ? "true" : "false") << ", \"max_steps\": " << analysis.mixing_max_steps
+         << ", \"steps\": ";
+  if (analysis.mixing_time) {
+    output << *analysis.mixing_time;
+  } else {
+    output << "null";
+  }
+  output << "}\n}\n";
+}
@@ -0,0 +1,268 @@
+// Source code of the persistent artifact cache.
+//
+// EVA License
+
+#include "artifact_cache.hpp"
+#include "helpers.hpp"
+#include "mapped_file.hpp"
+#include "markov.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+// Constants of MurmurHash3_x64_128.
+constexpr std::uint64_t MURMUR_C1 = 0x87c37b91114253d5ull;
+constexpr std::uint64_t MURMUR_C2 = 0x4cf5ad432745937full;
+// Once the cache grows beyond its limit, it is shrunk to this share of it, so that the next stores do not scan the
+// directory again right away.
+constexpr std::uintmax_t EVICTION_TARGET_PERCENT = 90;
+
+std::uint64_t rotl(std::uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+std::uint64_t fmix(std::uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+std::uint64_t process_id() {
+#ifdef _WIN32
+  return static_cast<std::uint64_t>(_getpid());
+#else
+  return static_cast<std::uint64_t>(getpid());
+#endif
+}
+
+// Returns the size of the regular files in the directory, leaving out artifacts that are still being written.
+std::uintmax_t artifact_bytes(const fs::path &directory) {
+  std::uintmax_t total_bytes = 0;
+  for (const fs::directory_entry &entry : fs::directory_iterator(directory)) {
+    std::error_code error;
+    if (entry.is_regular_file(error) && entry.path().extension() != ".partial") {
+      const std::uintmax_t size = entry.file_size(error);
+      if (!error)
+        total_bytes += size;
+    }
+  }
+  return total_bytes;
+}
+} // namespace
+
+void CacheKey::mix_block(std::uint64_t k1, std::uint64_t k2) {
+  h1 ^= rotl(k1 * MURMUR_C1, 31) * MURMUR_C2;
+  h1 = (rotl(h1, 27) + h2) * 5 + 0x52dce729;
+  h2 ^= rotl(k2 * MURMUR_C2, 33) * MURMUR_C1;
+  h2 = (rotl(h2, 31) + h1) * 5 + 0x38495ab5;
+}
+
+void CacheKey::add_bytes(const void *data, std::size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  length += size;
+  // Bytes left over from the last call are completed into a block first.
+  if (pending_size != 0) {
+    const std::size_t count = std::min(size, BLOCK_SIZE - pending_size);
+    std::memcpy(pending + pending_size, bytes, count);
+    pending_size += count;
+    bytes += count;
+    size -= count;
+    if (pending_size < BLOCK_SIZE) {
+      return;
+    }
+    std::uint64_t k[2];
+    std::memcpy(k, pending, BLOCK_SIZE);
+    mix_block(k[0], k[1]);
+    pending_size = 0;
+  }
+  for (; size >= BLOCK_SIZE; bytes += BLOCK_SIZE, size -= BLOCK_SIZE) {
+    std::uint64_t k[2];
+    std::memcpy(k, bytes, BLOCK_SIZE);
+    mix_block(k[0], k[1]);
+  }
+  std::memcpy(pending, bytes, size);
+  pending_size = size;
+}
+
+CacheKey &CacheKey::add(std::string_view text) {
+  add(static_cast<std::uint64_t>(text.size()));
+  add_bytes(text.data(), text.size());
+  return *this;
+}
+
+CacheKey &CacheKey::add(std::uint64_t value) {
+  add_bytes(&value, sizeof(value));
+  return *this;
+}
+
+CacheKey &CacheKey::add(double value) {
+  std::uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return add(bits);
+}
+
+CacheKey &CacheKey::add_file(const fs::path &file_path) {
+  if (!fs::exists(file_path)) {
+    throw std::runtime_error("Input file does not exist: " + file_path.string());
+  }
+  const MappedFile file(file_path);
+  add(static_cast<std::uint64_t>(file.size()));
+  add_bytes(file.data(), file.size());
+  return *this;
+}
+
+CacheKey &CacheKey::add_model(const MarkovModel &mc) {
+  const std::size_t n = mc.get_transition_matrix_size();
+  add(static_cast<std::uint64_t>(n));
+  for (std::size_t i = 0; i < n; i++) {
+    add(mc.get_state_name(i));
+    // Only the drawn transitions count, so the same chain hashes alike in dense and sparse storage.
+    const TransitionRow row = mc.get_transition_row(i);
+    for (std::size_t k = 0; k < row.count; k++) {
+      if (row.values[k] > 0) {
+        add(static_cast<std::uint64_t>(row.column(k)));
+        add(row.values[k]);
+      }
+    }
+    add(static_cast<std::uint64_t>(n));
+  }
+  return *this;
+}
+
+std::string CacheKey::hex() const {
+  // The tail and the length are mixed into copies, so that more can still be added to the key.
+  std::uint64_t a = h1;
+  std::uint64_t b = h2;
+  std::uint64_t k[2] = {0, 0};
+  std::memcpy(k, pending, pending_size);
+  a ^= rotl(k[0] * MURMUR_C1, 31) * MURMUR_C2;
+  b ^= rotl(k[1] * MURMUR_C2, 33) * MURMUR_C1;
+  a ^= length;
+  b ^= length;
+  a += b;
+  b += a;
+  a = fmix(a);
+  b = fmix(b);
+  a += b;
+  b += a;
+
+  std::ostringstream digits;
+  digits << std::hex << std::setfill('0') << std::setw(16) << a << std::setw(16) << b;
+  return digits.str();
+}
+
+ArtifactCache::ArtifactCache(const fs::path &cache_directory, std::uintmax_t max_bytes)
+    : cache_directory(cache_directory), max_bytes(max_bytes) {
+  create_dir(cache_directory);
+  total_bytes = artifact_bytes(cache_directory);
+  if (total_bytes > max_bytes) {
+    evict();
+  }
+}
+
+fs::path ArtifactCache::artifact_path(const CacheKey &key, const std::string &extension) const {
+  return cache_directory / (key.hex() + "." + extension);
+}
+
+bool ArtifactCache::fetch(const CacheKey &key, const std::string &extension, const fs::path &destination_path) const {
+  const fs::path cached_path = artifact_path(key, extension);
+  std::error_code error;
+  if (!fs::is_regular_file(cached_path, error)) {
+    return false;
+  }
+  // An artifact evicted during the copy is a miss like any other.
+  if (!fs::copy_file(cached_path, destination_path, fs::copy_options::overwrite_existing, error)) {
+    return false;
+  }
+  // The modification time doubles as the time of last use for eviction.
+  fs::last_write_time(cached_path, fs::file_time_type::clock::now(), error);
+  return true;
+}
+
+void ArtifactCache::store(const CacheKey &key, const std::string &extension, const fs::path &source_path) const {
+  static std::atomic<std::uint64_t> store_count{0};
+  const fs::path cached_path = artifact_path(key, extension);
+  // Other threads and runs may store the same key at once, so every store copies to a name of its own, and the
+  // artifact only appears under its key once it is complete. The copy needs no lock.
+  const fs::path temporary_path = cached_path.string() + "." + std::to_string(process_id()) + "-" +
+                                  std::to_string(store_count++) + ".partial";
+  std::uintmax_t size = 0;
+  std::uintmax_t replaced_size = 0;
+  try {
+    fs::copy_file(source_path, temporary_path, fs::copy_options::overwrite_existing);
+    size = fs::file_size(temporary_path);
+    std::error_code error;
+    replaced_size = fs::file_size(cached_path, error);
+    if (error)
+      replaced_size = 0;
+    fs::rename(temporary_path, cached_path);
+  } catch (const fs::filesystem_error &e) {
+    std::error_code error;
+    fs::remove(temporary_path, error);
+    throw std::runtime_error("Error caching artifact: " + std::string(e.what()));
+  }
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  total_bytes += size;
+  total_bytes -= std::min(total_bytes, replaced_size);
+  if (total_bytes > max_bytes) {
+    evict();
+  }
+}
+
+void ArtifactCache::evict() const {
+  // Other runs sharing the directory are not counted in total_bytes, so the directory is scanned again.
+  std::vector<std::pair<fs::file_time_type, fs::path>> artifacts;
+  total_bytes = 0;
+  for (const fs::directory_entry &entry : fs::directory_iterator(cache_directory)) {
+    std::error_code error;
+    if (entry.is_regular_file(error) && entry.path().extension() != ".partial") {
+      const std::uintmax_t size = entry.file_size(error);
+      const fs::file_time_type last_use = entry.last_write_time(error);
+      if (!error) {
+        total_bytes += size;
+        artifacts.emplace_back(last_use, entry.path());
+      }
+    }
+  }
+  const std::uintmax_t target_bytes = max_bytes / 100 * EVICTION_TARGET_PERCENT;
+  if (total_bytes <= max_bytes) {
+    return;
+  }
+
+  std::sort(artifacts.begin(), artifacts.end());
+  for (const auto &[last_use, path] : artifacts) {
+    if (total_bytes <= target_bytes) {
+      break;
+    }
+    std::error_code error;
+    const std::uintmax_t size = fs::file_size(path, error);
+    if (!error && fs::remove(path, error)) {
+      total_bytes -= size;
+      std::cout << "Evicted cached artifact " << path.filename() << "." << std::endl;
+    }
+  }
+}
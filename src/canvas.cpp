@@ -0,0 +1,219 @@
+// Source code of the antialiased rasterizer used by the native renderer.
+//
+// EVA License
+
+#include "canvas.hpp"
+#include "font.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+double clamp01(double value) { return std::min(1.0, std::max(0.0, value)); }
+
+// Returns the distance from p to the segment a-b.
+double segment_distance(Point p, Point a, Point b) {
+  const double dx = b.x - a.x;
+  const double dy = b.y - a.y;
+  const double length_squared = dx * dx + dy * dy;
+  double t = 0.0;
+  if (length_squared > 0.0) {
+    t = clamp01(((p.x - a.x) * dx + (p.y - a.y) * dy) / length_squared);
+  }
+  return std::hypot(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+}
+} // namespace
+
+Canvas::Canvas(std::size_t width, std::size_t height, Color background)
+    : canvas_width(width), canvas_height(height), data(width * height * 3) {
+  for (std::size_t i = 0; i < width * height; i++) {
+    data[3 * i] = background.r;
+    data[3 * i + 1] = background.g;
+    data[3 * i + 2] = background.b;
+  }
+}
+
+std::size_t Canvas::width() const { return canvas_width; }
+
+std::size_t Canvas::height() const { return canvas_height; }
+
+const std::vector<std::uint8_t> &Canvas::pixels() const { return data; }
+
+void Canvas::blend(std::size_t x, std::size_t y, Color color, double coverage) {
+  if (coverage <= 0.0) {
+    return;
+  }
+  std::uint8_t *pixel = &data[3 * (y * canvas_width + x)];
+  const std::uint8_t channels[3] = {color.r, color.g, color.b};
+  for (int c = 0; c < 3; c++) {
+    pixel[c] = static_cast<std::uint8_t>(std::lround(pixel[c] + (channels[c] - pixel[c]) * coverage));
+  }
+}
+
+bool Canvas::clip(double min_x, double min_y, double max_x, double max_y, std::size_t &x0, std::size_t &y0,
+                  std::size_t &x1, std::size_t &y1) const {
+  min_x = std::max(0.0, std::floor(min_x));
+  min_y = std::max(0.0, std::floor(min_y));
+  max_x = std::min(static_cast<double>(canvas_width) - 1.0, std::ceil(max_x));
+  max_y = std::min(static_cast<double>(canvas_height) - 1.0, std::ceil(max_y));
+  if (min_x > max_x || min_y > max_y) {
+    return false;
+  }
+  x0 = static_cast<std::size_t>(min_x);
+  y0 = static_cast<std::size_t>(min_y);
+  x1 = static_cast<std::size_t>(max_x);
+  y1 = static_cast<std::size_t>(max_y);
+  return true;
+}
+
+void Canvas::fill_circle(Point center, double radius, Color color) {
+  std::size_t x0, y0, x1, y1;
+  if (!clip(center.x - radius - 1, center.y - radius - 1, center.x + radius + 1, center.y + radius + 1, x0, y0, x1,
+            y1)) {
+    return;
+  }
+  for (std::size_t y = y0; y <= y1; y++) {
+    for (std::size_t x = x0; x <= x1; x++) {
+      const double distance = std::hypot(x + 0.5 - center.x, y + 0.5 - center.y);
+      blend(x, y, color, clamp01(radius + 0.5 - distance));
+    }
+  }
+}
+
+void Canvas::stroke_circle(Point center, double radius, double line_width, Color color) {
+  const double outer = radius + line_width / 2;
+  std::size_t x0, y0, x1, y1;
+  if (!clip(center.x - outer - 1, center.y - outer - 1, center.x + outer + 1, center.y + outer + 1, x0, y0, x1, y1)) {
+    return;
+  }
+  for (std::size_t y = y0; y <= y1; y++) {
+    for (std::size_t x = x0; x <= x1; x++) {
+      const double distance = std::abs(std::hypot(x + 0.5 - center.x, y + 0.5 - center.y) - radius);
+      blend(x, y, color, clamp01(line_width / 2 + 0.5 - distance));
+    }
+  }
+}
+
+void Canvas::stroke_polyline(const std::vector<Point> &points, double line_width, Color color) {
+  if (points.empty()) {
+    return;
+  }
+  if (points.size() == 1) {
+    fill_circle(points[0], line_width / 2, color);
+    return;
+  }
+
+  // Every segment only visits the pixels around itself, so long curves on large canvases stay cheap. A pixel near a
+  // join is drawn by the nearest of the neighboring segments only, which keeps the joins from being blended twice.
+  const double reach = line_width / 2 + 1;
+  const std::size_t segment_count = points.size() - 1;
+  for (std::size_t k = 0; k < segment_count; k++) {
+    const Point &a = points[k];
+    const Point &b = points[k + 1];
+    std::size_t x0, y0, x1, y1;
+    if (!clip(std::min(a.x, b.x) - reach, std::min(a.y, b.y) - reach, std::max(a.x, b.x) + reach,
+              std::max(a.y, b.y) + reach, x0, y0, x1, y1)) {
+      continue;
+    }
+    for (std::size_t y = y0; y <= y1; y++) {
+      for (std::size_t x = x0; x <= x1; x++) {
+        const Point p{x + 0.5, y + 0.5};
+        const double distance = segment_distance(p, a, b);
+        if (k > 0 && segment_distance(p, points[k - 1], a) <= distance) {
+          continue;
+        }
+        if (k + 1 < segment_count && segment_distance(p, b, points[k + 2]) < distance) {
+          continue;
+        }
+        blend(x, y, color, clamp01(line_width / 2 + 0.5 - distance));
+      }
+    }
+  }
+}
+
+void Canvas::fill_convex_polygon(const std::vector<Point> &points, Color color) {
+  if (points.size() < 3) {
+    return;
+  }
+  double area = 0.0;
+  double min_x = points[0].x, min_y = points[0].y, max_x = points[0].x, max_y = points[0].y;
+  for (std::size_t k = 0; k < points.size(); k++) {
+    const Point &a = points[k];
+    const Point &b = points[(k + 1) % points.size()];
+    area += a.x * b.y - b.x * a.y;
+    min_x = std::min(min_x, a.x);
+    min_y = std::min(min_y, a.y);
+    max_x = std::max(max_x, a.x);
+    max_y = std::max(max_y, a.y);
+  }
+  const double orientation = area < 0 ? -1.0 : 1.0;
+  std::size_t x0, y0, x1, y1;
+  if (!clip(min_x - 1, min_y - 1, max_x + 1, max_y + 1, x0, y0, x1, y1)) {
+    return;
+  }
+
+  // The signed distance to a convex polygon is at most the largest signed distance to the lines of its edges.
+  for (std::size_t y = y0; y <= y1; y++) {
+    for (std::size_t x = x0; x <= x1; x++) {
+      const Point p{x + 0.5, y + 0.5};
+      double distance = -1e300;
+      for (std::size_t k = 0; k < points.size(); k++) {
+        const Point &a = points[k];
+        const Point &b = points[(k + 1) % points.size()];
+        const double length = std::hypot(b.x - a.x, b.y - a.y);
+        if (length <= 0.0) {
+          continue;
+        }
+        const double cross = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+        distance = std::max(distance, -orientation * cross / length);
+      }
+      blend(x, y, color, clamp01(0.5 - distance));
+    }
+  }
+}
+
+void Canvas::draw_text(Point top_left, const std::string &text, std::size_t scale, Color color) {
+  // Rounding half up keeps the glyphs on the same pixels when a part of the canvas is drawn with an offset.
+  const long origin_x = static_cast<long>(std::floor(top_left.x + 0.5));
+  const long origin_y = static_cast<long>(std::floor(top_left.y + 0.5));
+  for (std::size_t i = 0; i < text.size(); i++) {
+    const std::uint8_t *columns = font::glyph(text[i]);
+    for (int column = 0; column < font::GLYPH_WIDTH; column++) {
+      for (int row = 0; row < font::GLYPH_HEIGHT; row++) {
+        if (!(columns[column] & (1 << row))) {
+          continue;
+        }
+        const long cell_x = origin_x + static_cast<long>((i * font::GLYPH_ADVANCE + column) * scale);
+        const long cell_y = origin_y + static_cast<long>(row * scale);
+        for (long y = std::max(0L, cell_y); y < std::min<long>(canvas_height, cell_y + scale); y++) {
+          for (long x = std::max(0L, cell_x); x < std::min<long>(canvas_width, cell_x + scale); x++) {
+            blend(x, y, color, 1.0);
+          }
+        }
+      }
+    }
+  }
+}
+
+void Canvas::blit(const Canvas &sprite, std::size_t x, std::size_t y) {
+  if (x >= canvas_width || y >= canvas_height) {
+    return;
+  }
+  const std::size_t width = std::min(sprite.canvas_width, canvas_width - x);
+  const std::size_t height = std::min(sprite.canvas_height, canvas_height - y);
+  for (std::size_t row = 0; row < height; row++) {
+    std::copy_n(&sprite.data[3 * row * sprite.canvas_width], 3 * width, &data[3 * ((y + row) * canvas_width + x)]);
+  }
+}
+
+std::size_t Canvas::text_width(const std::string &text, std::size_t scale) {
+  if (text.empty()) {
+    return 0;
+  }
+  return (text.size() * font::GLYPH_ADVANCE - (font::GLYPH_ADVANCE - font::GLYPH_WIDTH)) * scale;
+}
+
+std::size_t Canvas::text_height(std::size_t scale) { return font::GLYPH_HEIGHT * scale; }
@@ -1,79 +1,374 @@
 #include "ffmpeg.hpp"
+#include "artifact_cache.hpp"
 #include "helpers.hpp"
+#include "markov.hpp"
+#include "process.hpp"
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace fs = std::filesystem;
 
 void overlay_image_to_video(const fs::path &video_path, const fs::path &image_path, const fs::path &output_path,
-                            bool verbose) {
-  std::ostringstream command;
-  command << "ffmpeg -y -i " << video_path << " -i " << image_path << " -filter_complex overlay=10:10 " << output_path;
+                            bool verbose, std::size_t threads) {
+  Command command = {"ffmpeg", "-y", "-i", video_path.string(), "-i", image_path.string(), "-filter_complex",
+                     std::string(constants::DEFAULT_OVERLAY_FILTER)};
+  if (threads != 0) {
+    command.insert(command.end(), {"-threads", std::to_string(threads)});
+  }
+  command.push_back(output_path.string());
 
   execute_command(command, verbose);
 }
 
-void overlay_images_to_videos(const fs::path &videos_path, const std::string &video_extension,
-                              const fs::path &images_path, std::size_t file_count, const fs::path &outputs_path,
-                              bool verbose) {
-  // Ensure the input file exists
-  if (!fs::exists(videos_path)) {
-    throw std::runtime_error("Input videos folder does not exist: " + videos_path.string());
+bool ClipProfile::operator==(const ClipProfile &other) const {
+  return width == other.width && height == other.height && pixel_format == other.pixel_format &&
+         frame_rate == other.frame_rate && sample_rate == other.sample_rate && channels == other.channels;
+}
+
+std::string ClipProfile::to_string() const {
+  std::string description =
+      std::to_string(width) + "x" + std::to_string(height) + " " + pixel_format + " " + frame_rate + ", ";
+  if (sample_rate == 0) {
+    return description + "no audio";
   }
-  // Ensure the input file exists
-  if (!fs::exists(images_path)) {
-    throw std::runtime_error("Input images folder does not exist: " + images_path.string());
+  return description + std::to_string(sample_rate) + " Hz " + std::to_string(channels) + " channels";
+}
+
+namespace {
+// Parses a line of ffprobe's compact output, "key=value|key=value", into pairs.
+std::vector<std::pair<std::string, std::string>> parse_probe_line(const std::string &line) {
+  std::vector<std::pair<std::string, std::string>> entries;
+  std::istringstream stream(line);
+  std::string entry;
+  while (std::getline(stream, entry, '|')) {
+    const std::size_t separator = entry.find('=');
+    if (separator != std::string::npos) {
+      entries.emplace_back(entry.substr(0, separator), entry.substr(separator + 1));
+    }
   }
+  return entries;
+}
 
-  create_dir(outputs_path);
+std::size_t parse_probe_number(const std::string &value, const fs::path &video_path) {
+  try {
+    return std::stoul(value);
+  } catch (const std::exception &) {
+    throw std::runtime_error("Cannot read the probe of " + video_path.string() + ": " + value);
+  }
+}
 
-  for (std::size_t i = 0; i < file_count; i++) {
-    const fs::path &video_file_path = std::to_string(i) + "." + video_extension;
-    const fs::path &image_file_path = std::to_string(i) + ".png";
-    const fs::path &output_file_path =
-        std::to_string(i) + std::string(constants::DEFAULT_VIDEO_OVERLAY_NAME) + "." + video_extension;
-    std::cout << "Overlaying " << images_path / image_file_path << " to " << videos_path / video_file_path << "."
-              << std::endl;
-    overlay_image_to_video(videos_path / video_file_path, images_path / image_file_path,
-                           outputs_path / output_file_path, verbose);
+// Re-encodes the clip to the profile, scaling it into the canonical frame without distorting it.
+void encode_normalized_clip(const fs::path &video_path, const ClipProfile &clip_profile, const ClipProfile &profile,
+                            const fs::path &output_path, bool verbose) {
+  Command command = {"ffmpeg", "-y", "-i", video_path.string()};
+  const bool add_silence = profile.sample_rate != 0 && clip_profile.sample_rate == 0;
+  if (add_silence) {
+    command.insert(command.end(), {"-f", "lavfi", "-i",
+                                   "anullsrc=r=" + std::to_string(profile.sample_rate) +
+                                       ":cl=" + std::to_string(profile.channels) + "c",
+                                   "-map", "0:v", "-map", "1:a", "-shortest"});
+  }
+  const std::string size = std::to_string(profile.width) + ":" + std::to_string(profile.height);
+  command.insert(command.end(), {"-vf",
+                                 "scale=" + size + ":force_original_aspect_ratio=decrease,pad=" + size +
+                                     ":(ow-iw)/2:(oh-ih)/2,fps=" + profile.frame_rate +
+                                     ",format=" + profile.pixel_format,
+                                 "-flags", "+cgop"});
+  if (profile.sample_rate == 0) {
+    command.push_back("-an");
+  } else {
+    command.insert(command.end(),
+                   {"-ar", std::to_string(profile.sample_rate), "-ac", std::to_string(profile.channels)});
+  }
+  command.push_back(output_path.string());
+
+  execute_command(command, verbose);
+}
+} // namespace
+
+bool normalize_clip(const fs::path &video_path, const ClipProfile &clip_profile, const ClipProfile &profile,
+                    const fs::path &output_path, const std::string &video_extension, bool verbose,
+                    const ArtifactCache *cache) {
+  CacheKey key;
+  if (cache != nullptr) {
+    key.add("normalized clip").add_file(video_path).add(profile.to_string()).add(video_extension);
+    if (cache->fetch(key, video_extension, output_path)) {
+      return true;
+    }
+  }
+  encode_normalized_clip(video_path, clip_profile, profile, output_path, verbose);
+  if (cache != nullptr)
+    cache->store(key, video_extension, output_path);
+  return false;
+}
+
+ClipProfile canonical_clip_profile(const std::vector<ClipProfile> &profiles) {
+  if (profiles.empty()) {
+    throw std::invalid_argument("Cannot pick the canonical profile of no clips.");
+  }
+  std::vector<std::pair<ClipProfile, std::size_t>> profile_counts;
+  for (const ClipProfile &profile : profiles) {
+    const auto found = std::find_if(profile_counts.begin(), profile_counts.end(),
+                                    [&](const auto &profile_count) { return profile_count.first == profile; });
+    if (found == profile_counts.end())
+      profile_counts.emplace_back(profile, 1);
+    else
+      found->second++;
+  }
+  return std::max_element(profile_counts.begin(), profile_counts.end(), [](const auto &lhs, const auto &rhs) {
+           return lhs.second < rhs.second;
+         })->first;
+}
+
+ClipProfile probe_clip(const fs::path &video_path) {
+  const Command command = {"ffprobe", "-v", "error", "-show_entries",
+                           "stream=codec_type,width,height,pix_fmt,r_frame_rate,sample_rate,channels", "-of",
+                           "compact=p=0", video_path.string()};
+  std::istringstream output(execute_command_output(command));
+
+  ClipProfile profile;
+  bool has_video = false;
+  std::string line;
+  while (std::getline(output, line)) {
+    const auto entries = parse_probe_line(line);
+    const auto type =
+        std::find_if(entries.begin(), entries.end(), [](const auto &entry) { return entry.first == "codec_type"; });
+    if (type == entries.end()) {
+      continue;
+    }
+    const bool is_video = type->second == "video" && !has_video;
+    const bool is_audio = type->second == "audio" && profile.sample_rate == 0;
+    for (const auto &[key, value] : entries) {
+      if (is_video && key == "width")
+        profile.width = parse_probe_number(value, video_path);
+      else if (is_video && key == "height")
+        profile.height = parse_probe_number(value, video_path);
+      else if (is_video && key == "pix_fmt")
+        profile.pixel_format = value;
+      else if (is_video && key == "r_frame_rate")
+        profile.frame_rate = value;
+      else if (is_audio && key == "sample_rate")
+        profile.sample_rate = parse_probe_number(value, video_path);
+      else if (is_audio && key == "channels")
+        profile.channels = parse_probe_number(value, video_path);
+    }
+    has_video = has_video || is_video;
+  }
+  if (!has_video) {
+    throw std::runtime_error("No video stream found in " + video_path.string());
+  }
+  return profile;
+}
+
+bool overlay_segment(const fs::path &video_path, const fs::path &image_path, const fs::path &output_path,
+                     const std::string &video_extension, bool verbose, const ArtifactCache *cache,
+                     std::size_t threads) {
+  CacheKey key;
+  if (cache != nullptr) {
+    key.add("overlay")
+        .add_file(video_path)
+        .add_file(image_path)
+        .add(constants::DEFAULT_OVERLAY_FILTER)
+        .add(video_extension);
+    if (cache->fetch(key, video_extension, output_path)) {
+      return true;
+    }
+  }
+  overlay_image_to_video(video_path, image_path, output_path, verbose, threads);
+  if (cache != nullptr)
+    cache->store(key, video_extension, output_path);
+  return false;
+}
+
+namespace {
+// Calls on_run(state, length) for every run of equal consecutive states of the trajectory, in order.
+template <typename OnRun> void for_each_run(const MarkovTrajectory &markov_states, OnRun on_run) {
+  std::size_t run_state = 0;
+  std::size_t run_length = 0;
+  for (std::size_t state : markov_states) {
+    if (run_length != 0 && state != run_state) {
+      on_run(run_state, run_length);
+      run_length = 0;
+    }
+    run_state = state;
+    run_length++;
+  }
+  if (run_length != 0) {
+    on_run(run_state, run_length);
   }
 }
 
-void create_filelist(const std::vector<std::size_t> &markov_states, const fs::path &filelist_path,
-                     const std::string &overlay_name, const std::string &file_extension) {
+// Returns the name of the segment of state repeated repeat_count times.
+std::string repeated_segment_name(std::size_t state, const std::string &overlay_name, const std::string &file_extension,
+                                  std::uint64_t repeat_count) {
+  std::string name = std::to_string(state) + overlay_name;
+  if (repeat_count != 1) {
+    name += "_x" + std::to_string(repeat_count);
+  }
+  return name + "." + file_extension;
+}
+
+// Formats a duration given in microseconds as seconds, without the rounding of floating point output.
+std::string format_duration(std::uint64_t microseconds) {
+  std::string fraction = std::to_string(microseconds % 1000000);
+  fraction.insert(0, 6 - fraction.size(), '0');
+  return std::to_string(microseconds / 1000000) + "." + fraction;
+}
+} // namespace
+
+std::vector<std::uint64_t> create_filelist(const MarkovTrajectory &markov_states, const fs::path &filelist_path,
+                                           const std::string &overlay_name, const std::string &file_extension) {
   std::ofstream filelist(filelist_path);
+  if (!filelist.is_open()) {
+    throw std::runtime_error("Error opening filelist.");
+  }
 
-  if (filelist.is_open()) {
-    std::cout << "Creating filelist " << filelist_path << "." << std::endl;
-    for (std::size_t state : markov_states) {
-      filelist << "file '" << state << overlay_name << "." << file_extension << "'"
-               << std::endl;
+  std::cout << "Creating filelist " << filelist_path << "." << std::endl;
+  std::vector<std::uint64_t> repeat_masks;
+  std::size_t entry_count = 0;
+  for_each_run(markov_states, [&](std::size_t state, std::size_t length) {
+    if (state >= repeat_masks.size()) {
+      repeat_masks.resize(state + 1, 0);
     }
-    filelist.close();
-  } else {
+    // A run is split into powers of two, each of which names a segment repeated that many times.
+    for (unsigned bit = 64; bit-- > 0;) {
+      const std::uint64_t repeat_count = std::uint64_t{1} << bit;
+      if (length & repeat_count) {
+        repeat_masks[state] |= repeat_count;
+        filelist << "file '" << repeated_segment_name(state, overlay_name, file_extension, repeat_count) << "'\n";
+        entry_count++;
+      }
+    }
+  });
+  std::cout << "Wrote " << entry_count << " filelist entries for " << markov_states.get_iterations() + 1
+            << " segments." << std::endl;
+  return repeat_masks;
+}
+
+void create_repeated_segment(const fs::path &segments_folder_path, std::size_t state, std::uint64_t repeat_count,
+                             const std::string &overlay_name, const std::string &file_extension, bool verbose) {
+  const fs::path &segment_path = segments_folder_path / repeated_segment_name(state, overlay_name, file_extension, 1);
+  const fs::path &output_path =
+      segments_folder_path / repeated_segment_name(state, overlay_name, file_extension, repeat_count);
+  // The streams are copied, so repeating a segment costs no encoding.
+  const Command command = {"ffmpeg", "-y", "-stream_loop", std::to_string(repeat_count - 1), "-i",
+                           segment_path.string(), "-c", "copy", output_path.string()};
+  execute_command(command, verbose);
+}
+
+void create_image_filelist(const MarkovTrajectory &markov_states, const fs::path &filelist_path,
+                           const std::string &image_name) {
+  std::ofstream filelist(filelist_path);
+  if (!filelist.is_open()) {
     throw std::runtime_error("Error opening filelist.");
   }
+
+  std::cout << "Creating filelist " << filelist_path << "." << std::endl;
+  auto write_run = [&](std::size_t state, std::size_t length) {
+    filelist << "file '" << state << image_name << "'\n"
+             << "duration " << format_duration(length * constants::DEFAULT_IMAGE_FRAME_MICROSECONDS) << "\n";
+  };
+  // Runs are written one behind, so that the last one is known.
+  std::size_t last_state = 0;
+  std::size_t last_length = 0;
+  for_each_run(markov_states, [&](std::size_t state, std::size_t length) {
+    if (last_length > 0) {
+      write_run(last_state, last_length);
+    }
+    last_state = state;
+    last_length = length;
+  });
+  // The concat demuxer ignores the duration of the last file and shows it for a single frame, so the last run is
+  // written one frame shorter and followed by its file once more.
+  if (last_length > 1) {
+    write_run(last_state, last_length - 1);
+  }
+  filelist << "file '" << last_state << image_name << "'\n";
 }
 
 void combine_segments(const fs::path &filelist_path, const fs::path &output, bool verbose) {
   // Construct the ffmpeg command to combine videos side by side
-  std::ostringstream command;
-  command << "ffmpeg -y -f concat -safe 0 -i " << filelist_path << " -c copy " << output;
+  const Command command = {"ffmpeg", "-y", "-f", "concat", "-safe", "0", "-i", filelist_path.string(), "-c", "copy",
+                           output.string()};
 
   std::cout << "Combining segments." << std::endl;
   execute_command(command, verbose);
 }
 
-void create_gif(const fs::path &filelist_path, const fs::path &output_gif_path, bool verbose) {
-  std::ostringstream command;
-  command << "ffmpeg -y -f concat -safe 0 -i " << filelist_path << " -vf \"fps=10,scale=320:-1:flags=lanczos\" -c:v gif "
-          << output_gif_path;
+void generate_gif_palette(const fs::path &images_path, const std::vector<std::size_t> &states,
+                          const fs::path &palette_path, const GifOptions &options, bool verbose,
+                          const ArtifactCache *cache) {
+  CacheKey key;
+  if (cache != nullptr) {
+    key.add("gif palette").add(static_cast<std::uint64_t>(options.width));
+    for (std::size_t state : states) {
+      key.add_file(images_path / (std::to_string(state) + ".png"));
+    }
+    if (cache->fetch(key, "png", palette_path)) {
+      std::cout << "Using cached GIF palette." << std::endl;
+      return;
+    }
+  }
+
+  // palettegen accumulates the colors of every image it is given, so the images are read as one stream.
+  fs::path filelist_path = palette_path;
+  filelist_path.replace_extension(".txt");
+  {
+    std::ofstream filelist(filelist_path);
+    if (!filelist.is_open()) {
+      throw std::runtime_error("Error opening filelist.");
+    }
+    for (std::size_t state : states) {
+      filelist << "file '" << fs::absolute(images_path / (std::to_string(state) + ".png")).string() << "'\n";
+    }
+  }
+
+  const Command command = {"ffmpeg", "-y", "-f", "concat", "-safe", "0", "-i", filelist_path.string(), "-vf",
+                           "scale=" + std::to_string(options.width) + ":-1:flags=lanczos,palettegen",
+                           palette_path.string()};
+
+  std::cout << "Generating GIF palette from " << states.size() << " graphs." << std::endl;
+  execute_command(command, verbose);
+  if (cache != nullptr)
+    cache->store(key, "png", palette_path);
+}
+
+bool quantize_gif_frame(const fs::path &images_path, std::size_t state, const fs::path &palette_path,
+                        const GifOptions &options, bool verbose, const ArtifactCache *cache) {
+  const std::string &name = std::to_string(state);
+  const fs::path &image_path = images_path / (name + ".png");
+  const fs::path &frame_path = images_path / (name + std::string(constants::DEFAULT_GIF_FRAME_NAME));
+
+  CacheKey key;
+  if (cache != nullptr) {
+    key.add("gif frame").add_file(image_path).add_file(palette_path).add(static_cast<std::uint64_t>(options.width));
+    if (cache->fetch(key, "png", frame_path)) {
+      return true;
+    }
+  }
+  const std::string &filter =
+      "scale=" + std::to_string(options.width) + ":-1:flags=lanczos[frame];[frame][1:v]paletteuse";
+  const Command command = {"ffmpeg", "-y", "-i", image_path.string(), "-i", palette_path.string(), "-lavfi",
+                           filter, "-frames:v", "1", frame_path.string()};
+  execute_command(command, verbose);
+  if (cache != nullptr)
+    cache->store(key, "png", frame_path);
+  return false;
+}
+
+void create_gif(const fs::path &filelist_path, const fs::path &output_gif_path, const GifOptions &options,
+                bool verbose) {
+  const Command command = {"ffmpeg", "-y", "-f", "concat", "-safe", "0", "-i", filelist_path.string(), "-vf",
+                           "fps=" + std::to_string(options.fps), "-c:v", "gif", output_gif_path.string()};
 
   std::cout << "Creating GIF." << std::endl;
   execute_command(command, verbose);
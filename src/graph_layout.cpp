@@ -0,0 +1,525 @@
+// Source code of the layout engine of the Markov Graphs.
+//
+// EVA License
+
+#include "graph_layout.hpp"
+#include "canvas.hpp"
+#include "markov.hpp"
+#include "philox.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr std::size_t GRID_NODES_PER_ROW = 3;
+constexpr double GRID_ROW_OFFSET = -1.5;
+// Auto keeps the grid up to this many states, beyond it the grid becomes unreadable.
+constexpr std::size_t AUTO_GRID_MAX_STATES = 12;
+
+constexpr double FORCE_EDGE_LENGTH = 1.5;
+constexpr std::size_t FORCE_ITERATIONS = 300;
+constexpr double FORCE_GRAVITY = 0.02;
+constexpr std::uint64_t FORCE_SEED = 0x6d61726b6f76ull;
+constexpr double BARNES_HUT_THETA = 0.8;
+constexpr std::size_t QUADTREE_MAX_DEPTH = 32;
+// Nodes are 0.5 units wide, so this leaves room for an edge and its label between any two of them.
+constexpr double MIN_NODE_DISTANCE = 1.0;
+constexpr double MAX_SPREAD = 4.0;
+
+constexpr double LAYER_SPACING = 1.5;
+constexpr double LAYER_NODE_SPACING = 1.0;
+constexpr std::size_t LAYER_ORDER_SWEEPS = 8;
+
+constexpr double BUNDLE_CELL_SIZE = 3.0;
+// How far the control points of a bundle are pulled from their cell towards the other end.
+constexpr double BUNDLE_PULL = 0.25;
+
+struct Transition {
+  std::size_t from;
+  std::size_t to;
+  double probability;
+};
+
+double distance(Point a, Point b) { return std::hypot(a.x - b.x, a.y - b.y); }
+
+// Rounds to three decimals so the coordinates stay short in the TikZ source.
+double round_coordinate(double value) { return std::round(value * 1000.0) / 1000.0; }
+
+// Returns the drawn transitions in row-major order.
+std::vector<Transition> collect_transitions(const MarkovModel &mc, double prune_threshold) {
+  std::vector<Transition> transitions;
+  for (std::size_t i = 0; i < mc.get_transition_matrix_size(); ++i) {
+    const TransitionRow row = mc.get_transition_row(i);
+    for (std::size_t k = 0; k < row.count; ++k) {
+      const double probability = row.values[k];
+      if (probability > 0 && probability >= prune_threshold) {
+        transitions.push_back({i, row.column(k), probability});
+      }
+    }
+  }
+  return transitions;
+}
+
+// Assigns every state a layer so that transitions lead to later layers. Cycles are broken by starting from the
+// remaining state with the fewest unplaced predecessors. Returns false if a cycle had to be broken.
+bool assign_layers(std::size_t n, const std::vector<Transition> &transitions, std::vector<std::size_t> &layers) {
+  std::vector<std::vector<std::size_t>> successors(n);
+  std::vector<std::size_t> in_degree(n, 0);
+  for (const Transition &transition : transitions) {
+    if (transition.from != transition.to) {
+      successors[transition.from].push_back(transition.to);
+      in_degree[transition.to]++;
+    }
+  }
+
+  layers.assign(n, 0);
+  std::vector<bool> placed(n, false);
+  std::vector<std::size_t> queue;
+  for (std::size_t i = 0; i < n; i++) {
+    if (in_degree[i] == 0) {
+      queue.push_back(i);
+    }
+  }
+
+  bool acyclic = true;
+  std::size_t head = 0;
+  std::size_t placed_count = 0;
+  while (placed_count < n) {
+    if (head == queue.size()) {
+      acyclic = false;
+      std::size_t start = n;
+      for (std::size_t i = 0; i < n; i++) {
+        if (!placed[i] && (start == n || in_degree[i] < in_degree[start])) {
+          start = i;
+        }
+      }
+      queue.push_back(start);
+    }
+    const std::size_t state = queue[head++];
+    if (placed[state]) {
+      continue;
+    }
+    placed[state] = true;
+    placed_count++;
+    for (std::size_t successor : successors[state]) {
+      if (placed[successor]) {
+        continue;
+      }
+      layers[successor] = std::max(layers[successor], layers[state] + 1);
+      if (--in_degree[successor] == 0) {
+        queue.push_back(successor);
+      }
+    }
+  }
+  return acyclic;
+}
+
+// Quadtree over the node positions that approximates the repulsion of far away groups of nodes by their center of
+// mass (Barnes and Hut, 1986), so an iteration of the force-directed layout takes O(n log n) instead of O(n^2).
+class QuadTree {
+public:
+  explicit QuadTree(const std::vector<Point> &points) : points(points) {
+    double min_x = points[0].x, min_y = points[0].y, max_x = points[0].x, max_y = points[0].y;
+    for (const Point &point : points) {
+      min_x = std::min(min_x, point.x);
+      min_y = std::min(min_y, point.y);
+      max_x = std::max(max_x, point.x);
+      max_y = std::max(max_y, point.y);
+    }
+    cells.push_back({{0.0, 0.0}, 0, min_x, min_y, std::max(max_x - min_x, max_y - min_y) + 1e-9, {}, -1});
+    cells[0].children.fill(-1);
+    for (std::size_t i = 0; i < points.size(); i++) {
+      insert(0, i, 0);
+    }
+  }
+
+  // Returns the repulsion of every other node on node body, with the force k^2 / d of Fruchterman and Reingold.
+  Point repulsion(std::size_t body, double k_squared) const {
+    const Point p = points[body];
+    Point force{0.0, 0.0};
+    std::vector<std::size_t> stack = {0};
+    while (!stack.empty()) {
+      const Cell &cell = cells[stack.back()];
+      stack.pop_back();
+      const bool leaf = cell.children == std::array<std::int32_t, 4>{-1, -1, -1, -1};
+      if (cell.mass == 0 || (leaf && cell.body == static_cast<std::int32_t>(body))) {
+        continue;
+      }
+      const Point center{cell.sum.x / cell.mass, cell.sum.y / cell.mass};
+      const double d = distance(p, center);
+      if (leaf || cell.size < BARNES_HUT_THETA * d) {
+        if (d > 1e-9) {
+          const double magnitude = k_squared * cell.mass / d;
+          force.x += (p.x - center.x) / d * magnitude;
+          force.y += (p.y - center.y) / d * magnitude;
+        }
+        continue;
+      }
+      for (std::int32_t child : cell.children) {
+        if (child >= 0) {
+          stack.push_back(static_cast<std::size_t>(child));
+        }
+      }
+    }
+    return force;
+  }
+
+private:
+  struct Cell {
+    // Sum of the positions of the nodes inside, divided by mass for their center.
+    Point sum;
+    std::size_t mass;
+    double x, y, size;
+    std::array<std::int32_t, 4> children;
+    // The node of a leaf holding a single node, -1 otherwise.
+    std::int32_t body;
+  };
+
+  const std::vector<Point> &points;
+  std::vector<Cell> cells;
+
+  void insert(std::size_t cell, std::size_t body, std::size_t depth) {
+    const Point p = points[body];
+    if (cells[cell].mass == 0) {
+      cells[cell].body = static_cast<std::int32_t>(body);
+      cells[cell].mass = 1;
+      cells[cell].sum = p;
+      return;
+    }
+    // Nodes at the same position would split cells forever, below the depth limit they are merged instead.
+    if (cells[cell].body >= 0 && depth < QUADTREE_MAX_DEPTH) {
+      insert_child(cell, static_cast<std::size_t>(cells[cell].body), depth);
+    }
+    cells[cell].body = -1;
+    cells[cell].mass++;
+    cells[cell].sum.x += p.x;
+    cells[cell].sum.y += p.y;
+    if (depth < QUADTREE_MAX_DEPTH) {
+      insert_child(cell, body, depth);
+    }
+  }
+
+  void insert_child(std::size_t cell, std::size_t body, std::size_t depth) {
+    const double half = cells[cell].size / 2;
+    const bool right = points[body].x >= cells[cell].x + half;
+    const bool top = points[body].y >= cells[cell].y + half;
+    const std::size_t quadrant = (right ? 1 : 0) + (top ? 2 : 0);
+    if (cells[cell].children[quadrant] < 0) {
+      Cell child{{0.0, 0.0}, 0, cells[cell].x + (right ? half : 0.0), cells[cell].y + (top ? half : 0.0), half, {},
+                 -1};
+      child.children.fill(-1);
+      cells[cell].children[quadrant] = static_cast<std::int32_t>(cells.size());
+      cells.push_back(child);
+    }
+    insert(static_cast<std::size_t>(cells[cell].children[quadrant]), body, depth + 1);
+  }
+};
+
+// Returns the distance between the closest two positions, or limit if no two are closer than that. Only positions in
+// the same or neighbouring cells of a grid of limit sized cells can be closer, so each one is compared with a few
+// others. The search stops at the first pair closer than stop_below, which also bounds how many positions can crowd
+// into one cell before such a pair turns up.
+double closest_distance(const std::vector<Point> &positions, double limit, double stop_below) {
+  std::map<std::pair<std::int64_t, std::int64_t>, std::vector<std::size_t>> cells;
+  auto cell_of = [limit](Point p) {
+    return std::make_pair(static_cast<std::int64_t>(std::floor(p.x / limit)),
+                          static_cast<std::int64_t>(std::floor(p.y / limit)));
+  };
+  double closest = limit;
+  for (std::size_t i = 0; i < positions.size(); i++) {
+    const auto [column, row] = cell_of(positions[i]);
+    for (std::int64_t dx = -1; dx <= 1; dx++) {
+      for (std::int64_t dy = -1; dy <= 1; dy++) {
+        const auto cell = cells.find({column + dx, row + dy});
+        if (cell == cells.end()) {
+          continue;
+        }
+        for (std::size_t j : cell->second) {
+          closest = std::min(closest, distance(positions[i], positions[j]));
+        }
+      }
+    }
+    if (closest < stop_below) {
+      return closest;
+    }
+    cells[{column, row}].push_back(i);
+  }
+  return closest;
+}
+
+std::vector<Point> grid_positions(std::size_t n) {
+  std::vector<Point> positions;
+  for (std::size_t i = 0; i < n; ++i) {
+    positions.push_back(
+        {static_cast<double>(i % GRID_NODES_PER_ROW), static_cast<double>(i / GRID_NODES_PER_ROW) * GRID_ROW_OFFSET});
+  }
+  return positions;
+}
+
+std::vector<Point> force_positions(std::size_t n, const std::vector<Transition> &transitions) {
+  // Start from a square grid, slightly perturbed so that symmetric chains can unfold. The perturbation is seeded so the
+  // layout is the same on every run.
+  const std::size_t columns = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(n))));
+  std::vector<Point> positions(n);
+  for (std::size_t i = 0; i < n; i++) {
+    positions[i] = {(i % columns + 0.1 * philox_uniform(FORCE_SEED, 0, 2 * i)) * FORCE_EDGE_LENGTH,
+                    (i / columns + 0.1 * philox_uniform(FORCE_SEED, 0, 2 * i + 1)) * FORCE_EDGE_LENGTH};
+  }
+
+  const double k = FORCE_EDGE_LENGTH;
+  const double initial_temperature = k * std::sqrt(static_cast<double>(n)) / 4;
+  std::vector<Point> displacement(n);
+  for (std::size_t iteration = 0; iteration < FORCE_ITERATIONS; iteration++) {
+    Point center{0.0, 0.0};
+    for (const Point &position : positions) {
+      center.x += position.x / n;
+      center.y += position.y / n;
+    }
+
+    const QuadTree tree(positions);
+    for (std::size_t i = 0; i < n; i++) {
+      displacement[i] = tree.repulsion(i, k * k);
+      displacement[i].x -= (positions[i].x - center.x) * FORCE_GRAVITY;
+      displacement[i].y -= (positions[i].y - center.y) * FORCE_GRAVITY;
+    }
+    for (const Transition &transition : transitions) {
+      if (transition.from == transition.to) {
+        continue;
+      }
+      const Point &a = positions[transition.from];
+      const Point &b = positions[transition.to];
+      const double d = distance(a, b);
+      if (d <= 1e-9) {
+        continue;
+      }
+      const double magnitude = d / k;
+      displacement[transition.from].x -= (a.x - b.x) * magnitude;
+      displacement[transition.from].y -= (a.y - b.y) * magnitude;
+      displacement[transition.to].x += (a.x - b.x) * magnitude;
+      displacement[transition.to].y += (a.y - b.y) * magnitude;
+    }
+
+    const double temperature = initial_temperature * (1.0 - static_cast<double>(iteration) / FORCE_ITERATIONS);
+    for (std::size_t i = 0; i < n; i++) {
+      const double length = std::hypot(displacement[i].x, displacement[i].y);
+      if (length > 1e-12) {
+        const double step = std::min(length, temperature) / length;
+        positions[i].x += displacement[i].x * step;
+        positions[i].y += displacement[i].y * step;
+      }
+    }
+  }
+
+  // Spread the nodes until no two of them overlap, within reason, and center the layout.
+  const double closest = closest_distance(positions, MIN_NODE_DISTANCE, MIN_NODE_DISTANCE / MAX_SPREAD);
+  Point center{0.0, 0.0};
+  for (const Point &position : positions) {
+    center.x += position.x / n;
+    center.y += position.y / n;
+  }
+  const double spread = closest < MIN_NODE_DISTANCE ? std::min(MAX_SPREAD, MIN_NODE_DISTANCE / closest) : 1.0;
+  for (Point &position : positions) {
+    position = {round_coordinate((position.x - center.x) * spread), round_coordinate((position.y - center.y) * spread)};
+  }
+  return positions;
+}
+
+std::vector<Point> layered_positions(std::size_t n, const std::vector<Transition> &transitions,
+                                     const std::vector<std::size_t> &layer_of) {
+  std::vector<std::vector<std::size_t>> layers(*std::max_element(layer_of.begin(), layer_of.end()) + 1);
+  for (std::size_t i = 0; i < n; i++) {
+    layers[layer_of[i]].push_back(i);
+  }
+  std::vector<std::vector<std::size_t>> neighbors(n);
+  for (const Transition &transition : transitions) {
+    if (transition.from != transition.to) {
+      neighbors[transition.from].push_back(transition.to);
+      neighbors[transition.to].push_back(transition.from);
+    }
+  }
+
+  // Reduce crossings by ordering every layer by the mean position of its neighbors in the previous layer, sweeping down
+  // and up alternately.
+  std::vector<double> order(n);
+  for (const std::vector<std::size_t> &layer : layers) {
+    for (std::size_t k = 0; k < layer.size(); k++) {
+      order[layer[k]] = static_cast<double>(k);
+    }
+  }
+  auto sort_layer = [&](std::vector<std::size_t> &layer, std::size_t reference_layer) {
+    std::vector<std::pair<double, std::size_t>> keys;
+    for (std::size_t state : layer) {
+      double sum = 0.0;
+      std::size_t count = 0;
+      for (std::size_t neighbor : neighbors[state]) {
+        if (layer_of[neighbor] == reference_layer) {
+          sum += order[neighbor];
+          count++;
+        }
+      }
+      keys.emplace_back(count == 0 ? order[state] : sum / count, state);
+    }
+    std::stable_sort(keys.begin(), keys.end(),
+                     [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (std::size_t k = 0; k < layer.size(); k++) {
+      layer[k] = keys[k].second;
+      order[layer[k]] = static_cast<double>(k);
+    }
+  };
+  for (std::size_t sweep = 0; sweep < LAYER_ORDER_SWEEPS; sweep++) {
+    if (sweep % 2 == 0) {
+      for (std::size_t l = 1; l < layers.size(); l++) {
+        sort_layer(layers[l], l - 1);
+      }
+    } else {
+      for (std::size_t l = layers.size() - 1; l-- > 0;) {
+        sort_layer(layers[l], l + 1);
+      }
+    }
+  }
+
+  std::vector<Point> positions(n);
+  for (std::size_t l = 0; l < layers.size(); l++) {
+    for (std::size_t k = 0; k < layers[l].size(); k++) {
+      positions[layers[l][k]] = {(k - (layers[l].size() - 1) / 2.0) * LAYER_NODE_SPACING,
+                                 static_cast<double>(l) * -LAYER_SPACING};
+    }
+  }
+  return positions;
+}
+
+// The edge shapes and label sides of write_markov_graph's original grid layout.
+void shape_grid_edge(LayoutEdge &edge) {
+  const std::size_t i = edge.from;
+  const std::size_t j = edge.to;
+  if (i == j) {
+    edge.shape = EdgeShape::Loop;
+    edge.label = LabelPlacement::Above;
+    return;
+  }
+  const bool isLeftNode = (i % GRID_NODES_PER_ROW) < (j % GRID_NODES_PER_ROW);
+  const bool isSameRow = (i / GRID_NODES_PER_ROW) == (j / GRID_NODES_PER_ROW);
+  if ((j - i) % 2 == 0) {
+    edge.shape = EdgeShape::Left;
+    edge.label = isSameRow ? (isLeftNode ? LabelPlacement::Above : LabelPlacement::Below) : LabelPlacement::Above;
+  } else {
+    edge.shape = EdgeShape::Right;
+    edge.label = isSameRow ? (isLeftNode ? LabelPlacement::Below : LabelPlacement::Above) : LabelPlacement::Below;
+  }
+}
+
+// Routes every edge between two different cells of a coarse grid through control points near the centers of both
+// cells. Edges that connect the same two regions then share their path and merge into a bundle.
+void bundle_edges(GraphLayout &layout) {
+  using CellIndex = std::pair<long, long>;
+  auto cell_of = [](Point p) {
+    return CellIndex{std::lround(std::floor(p.x / BUNDLE_CELL_SIZE)), std::lround(std::floor(p.y / BUNDLE_CELL_SIZE))};
+  };
+  std::map<CellIndex, std::pair<Point, std::size_t>> centers;
+  for (const Point &position : layout.positions) {
+    auto &[sum, count] = centers[cell_of(position)];
+    sum.x += position.x;
+    sum.y += position.y;
+    count++;
+  }
+  auto center_of = [&](Point p) {
+    const auto &[sum, count] = centers.at(cell_of(p));
+    return Point{sum.x / count, sum.y / count};
+  };
+
+  for (LayoutEdge &edge : layout.edges) {
+    const Point from = layout.positions[edge.from];
+    const Point to = layout.positions[edge.to];
+    if (edge.from == edge.to || cell_of(from) == cell_of(to)) {
+      continue;
+    }
+    const Point a = center_of(from);
+    const Point b = center_of(to);
+    edge.shape = EdgeShape::Bundled;
+    edge.label = LabelPlacement::None;
+    edge.control_from = {round_coordinate(a.x + (b.x - a.x) * BUNDLE_PULL),
+                         round_coordinate(a.y + (b.y - a.y) * BUNDLE_PULL)};
+    edge.control_to = {round_coordinate(b.x + (a.x - b.x) * BUNDLE_PULL),
+                       round_coordinate(b.y + (a.y - b.y) * BUNDLE_PULL)};
+  }
+}
+} // namespace
+
+GraphLayout compute_graph_layout(const MarkovModel &mc, const LayoutOptions &options) {
+  const std::size_t n = mc.get_transition_matrix_size();
+  const std::vector<Transition> transitions = collect_transitions(mc, options.prune_threshold);
+
+  std::vector<std::size_t> layers;
+  LayoutAlgorithm algorithm = options.algorithm;
+  if (n == 0) {
+    algorithm = LayoutAlgorithm::Grid;
+  } else if (algorithm == LayoutAlgorithm::Auto) {
+    if (n <= AUTO_GRID_MAX_STATES)
+      algorithm = LayoutAlgorithm::Grid;
+    else if (assign_layers(n, transitions, layers))
+      algorithm = LayoutAlgorithm::Layered;
+    else
+      algorithm = LayoutAlgorithm::Force;
+  }
+
+  GraphLayout layout;
+  switch (algorithm) {
+  case LayoutAlgorithm::Force:
+    layout.positions = force_positions(n, transitions);
+    break;
+  case LayoutAlgorithm::Layered:
+    if (layers.empty())
+      assign_layers(n, transitions, layers);
+    layout.positions = layered_positions(n, transitions, layers);
+    break;
+  default:
+    layout.positions = grid_positions(n);
+    break;
+  }
+
+  std::set<std::pair<std::size_t, std::size_t>> drawn;
+  for (const Transition &transition : transitions) {
+    drawn.emplace(transition.from, transition.to);
+  }
+  for (const Transition &transition : transitions) {
+    LayoutEdge edge{transition.from, transition.to, transition.probability, EdgeShape::Straight,
+                    LabelPlacement::Auto, {0.0, 0.0}, {0.0, 0.0}};
+    if (algorithm == LayoutAlgorithm::Grid) {
+      shape_grid_edge(edge);
+    } else if (edge.from == edge.to) {
+      edge.shape = EdgeShape::Loop;
+      edge.label = LabelPlacement::Above;
+    } else if (drawn.count({edge.to, edge.from}) != 0 ||
+               (algorithm == LayoutAlgorithm::Layered && layers[edge.from] + 1 != layers[edge.to])) {
+      // Opposite edges both bend left so they do not overlap, and layered edges that skip or go back a layer bend
+      // around the nodes in between.
+      edge.shape = EdgeShape::Left;
+    }
+    layout.edges.push_back(edge);
+  }
+
+  if (options.bundle_edges)
+    bundle_edges(layout);
+  return layout;
+}
+
+LayoutAlgorithm layout_algorithm_from_string(const std::string &name) {
+  if (name == "auto")
+    return LayoutAlgorithm::Auto;
+  else if (name == "grid")
+    return LayoutAlgorithm::Grid;
+  else if (name == "force")
+    return LayoutAlgorithm::Force;
+  else if (name == "layered")
+    return LayoutAlgorithm::Layered;
+  else
+    throw std::invalid_argument("Unknown layout algorithm: " + name);
+}
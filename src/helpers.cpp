@@ -9,6 +9,19 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 namespace fs = std::filesystem;
 
@@ -46,26 +59,60 @@ void delete_dir_or_file(const fs::path &folder_path) {
 }
 
 #ifdef _WIN32
-void check_verbosity(std::ostringstream &command, bool verbose) {
-  if (!verbose) {
-    command << "> NUL 2>&1";
+void write_file(const fs::path &file_path, const std::vector<std::string_view> &pieces) {
+  std::ofstream file(file_path, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open file: " + file_path.string());
+  }
+  for (std::string_view piece : pieces) {
+    file.write(piece.data(), static_cast<std::streamsize>(piece.size()));
+  }
+  if (!file) {
+    throw std::runtime_error("Cannot write file: " + file_path.string());
   }
 }
 #else
-void check_verbosity(std::ostringstream &command, bool verbose) {
-  if (!verbose) {
-    command << ">& /dev/null";
+void write_file(const fs::path &file_path, const std::vector<std::string_view> &pieces) {
+  const int file_descriptor = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file_descriptor < 0) {
+    throw std::runtime_error("Cannot open file: " + file_path.string());
+  }
+
+  std::vector<iovec> vectors;
+  vectors.reserve(pieces.size());
+  for (std::string_view piece : pieces) {
+    if (!piece.empty()) {
+      vectors.push_back({const_cast<char *>(piece.data()), piece.size()});
+    }
   }
-}
-#endif
 
-void execute_command(std::ostringstream &command, bool verbose) {
-  check_verbosity(command, verbose);
-  int return_code = std::system(command.str().c_str());
-  if (return_code != 0) {
-    throw std::runtime_error("Command execution failed: " + command.str());
+  // writev may write only part of the pieces, the rest is written by further calls starting where it stopped.
+  std::size_t next = 0;
+  while (next < vectors.size()) {
+    const int count = static_cast<int>(std::min<std::size_t>(vectors.size() - next, IOV_MAX));
+    const ssize_t written = writev(file_descriptor, &vectors[next], count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(file_descriptor);
+      throw std::runtime_error("Cannot write file: " + file_path.string());
+    }
+    std::size_t remaining = static_cast<std::size_t>(written);
+    while (next < vectors.size() && remaining >= vectors[next].iov_len) {
+      remaining -= vectors[next++].iov_len;
+    }
+    if (remaining != 0) {
+      vectors[next].iov_base = static_cast<char *>(vectors[next].iov_base) + remaining;
+      vectors[next].iov_len -= remaining;
+    }
+  }
+
+  if (close(file_descriptor) != 0) {
+    throw std::runtime_error("Cannot write file: " + file_path.string());
   }
 }
+#endif
 
 void wait_on_enter() {
   std::cout << "Please press enter after you are done." << std::endl;
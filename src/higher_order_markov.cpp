@@ -0,0 +1,251 @@
+// Source code of the implementation of higher-order Markov Chains.
+//
+// EVA License
+
+#include "higher_order_markov.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+// splitmix64 finalizer. Packed contexts are far from uniform, so they are mixed before being masked into the table.
+std::uint64_t mix_context(std::uint64_t context) {
+  context ^= context >> 30;
+  context *= 0xbf58476d1ce4e5b9ULL;
+  context ^= context >> 27;
+  context *= 0x94d049bb133111ebULL;
+  return context ^ (context >> 31);
+}
+
+std::string context_to_string(std::uint64_t context, std::size_t order, std::size_t states) {
+  std::vector<std::uint64_t> context_states(order);
+  for (std::size_t i = order; i-- > 0;) {
+    context_states[i] = context % states;
+    context /= states;
+  }
+
+  std::string text;
+  for (std::size_t i = 0; i < order; i++) {
+    text += (i == 0 ? "" : " ") + std::to_string(context_states[i]);
+  }
+  return text;
+}
+} // namespace
+
+void ContextTable::reset(std::size_t count) {
+  std::size_t capacity = 2;
+  while (capacity < 2 * count) {
+    capacity *= 2;
+  }
+  keys.assign(capacity, EMPTY);
+  rows.assign(capacity, 0);
+  mask = capacity - 1;
+  this->count = 0;
+}
+
+bool ContextTable::insert(std::uint64_t context, std::size_t row) {
+  for (std::size_t slot = mix_context(context) & mask;; slot = (slot + 1) & mask) {
+    if (keys[slot] == context) {
+      return false;
+    }
+    if (keys[slot] == EMPTY) {
+      keys[slot] = context;
+      rows[slot] = row;
+      count++;
+      return true;
+    }
+  }
+}
+
+std::size_t ContextTable::find(std::uint64_t context) const {
+  for (std::size_t slot = mix_context(context) & mask;; slot = (slot + 1) & mask) {
+    if (keys[slot] == context) {
+      return rows[slot];
+    }
+    if (keys[slot] == EMPTY) {
+      return NOT_FOUND;
+    }
+  }
+}
+
+std::size_t ContextTable::size() const { return count; }
+
+HigherOrderMarkovChain::HigherOrderMarkovChain(const fs::path &markov_file, const MatrixOptions &options) {
+  ContextMatrix context_matrix = read_context_matrix(markov_file, options.storage);
+  order = context_matrix.order;
+  states = context_matrix.transitions.column_count();
+  transitions = std::move(context_matrix.transitions);
+  if (transitions.size() == 0) {
+    throw std::invalid_argument("Higher-order chain file has no contexts.");
+  }
+  if (options.normalize) {
+    transitions.normalize_rows();
+  }
+
+  pack_contexts(context_matrix.contexts);
+  validate_transitions();
+  build_sampler();
+  build_projection();
+  set_current_context(row_contexts[0]);
+}
+
+void HigherOrderMarkovChain::pack_contexts(const std::vector<std::uint32_t> &context_states) {
+  // The packed contexts have to stay below the EMPTY key of the context table.
+  history_modulus = 1;
+  for (std::size_t i = 1; i < order; i++) {
+    if (history_modulus > (std::uint64_t{1} << 63) / states / states) {
+      throw std::invalid_argument("Higher-order chain has too many possible contexts, reduce the order or the states.");
+    }
+    history_modulus *= states;
+  }
+
+  const std::size_t context_count = transitions.size();
+  row_contexts.resize(context_count);
+  contexts.reset(context_count);
+  state_contexts.assign(states, EMPTY_CONTEXT);
+  for (std::size_t i = 0; i < context_count; i++) {
+    std::uint64_t context = 0;
+    for (std::size_t j = 0; j < order; j++) {
+      const std::uint32_t state = context_states[i * order + j];
+      if (state >= states) {
+        throw std::invalid_argument("Context of row " + std::to_string(i) + " refers to state " +
+                                    std::to_string(state) + ", but the chain only has " + std::to_string(states) +
+                                    " states.");
+      }
+      context = context * states + state;
+    }
+    if (!contexts.insert(context, i)) {
+      throw std::invalid_argument("Context \"" + context_to_string(context, order, states) +
+                                  "\" is listed more than once.");
+    }
+    row_contexts[i] = context;
+
+    std::uint64_t &state_context = state_contexts[context_state(context)];
+    if (state_context == EMPTY_CONTEXT) {
+      state_context = context;
+    }
+  }
+}
+
+void HigherOrderMarkovChain::validate_transitions() const {
+  throw_if_invalid_rows(transitions, constants::EPSILON);
+
+  // Every context a chain can move to must have a row, otherwise sampling would run off the table.
+  for (std::size_t i = 0; i < transitions.size(); i++) {
+    const TransitionRow row = transitions.row(i);
+    const std::uint64_t history = (row_contexts[i] % history_modulus) * states;
+    for (std::size_t k = 0; k < row.count; k++) {
+      if (row.values[k] <= 0.0) {
+        continue;
+      }
+      const std::uint64_t next = history + (row.columns ? row.columns[k] : k);
+      if (contexts.find(next) == ContextTable::NOT_FOUND) {
+        throw std::invalid_argument("Context \"" + context_to_string(row_contexts[i], order, states) +
+                                    "\" can move to context \"" + context_to_string(next, order, states) +
+                                    "\", which has no transition probabilities.");
+      }
+    }
+  }
+}
+
+void HigherOrderMarkovChain::build_sampler() {
+  sampler.clear();
+  for (std::size_t i = 0; i < transitions.size(); i++) {
+    const TransitionRow row = transitions.row(i);
+    sampler.add_row(row.values, row.columns, row.count);
+  }
+}
+
+void HigherOrderMarkovChain::build_projection() {
+  // Bucket the context rows by the state they end in.
+  std::vector<std::size_t> bucket_offsets(states + 1, 0);
+  for (const std::uint64_t context : row_contexts) {
+    bucket_offsets[context_state(context) + 1]++;
+  }
+  for (std::size_t s = 0; s < states; s++) {
+    bucket_offsets[s + 1] += bucket_offsets[s];
+  }
+  std::vector<std::size_t> bucket_rows(row_contexts.size());
+  std::vector<std::size_t> next_slot(bucket_offsets.begin(), bucket_offsets.end() - 1);
+  for (std::size_t i = 0; i < row_contexts.size(); i++) {
+    bucket_rows[next_slot[context_state(row_contexts[i])]++] = i;
+  }
+
+  // Accumulate the rows of every bucket into a dense scratch row, touching only the columns that are set.
+  std::vector<double> accumulator(states, 0.0);
+  std::vector<bool> seen(states, false);
+  std::vector<std::uint32_t> touched;
+  std::vector<double> row_values;
+  projection = TransitionMatrix();
+  for (std::size_t s = 0; s < states; s++) {
+    const std::size_t bucket_size = bucket_offsets[s + 1] - bucket_offsets[s];
+    touched.clear();
+    for (std::size_t b = bucket_offsets[s]; b < bucket_offsets[s + 1]; b++) {
+      const TransitionRow row = transitions.row(bucket_rows[b]);
+      for (std::size_t k = 0; k < row.count; k++) {
+        if (std::fpclassify(row.values[k]) == FP_ZERO) {
+          continue;
+        }
+        const std::uint32_t column = row.columns ? row.columns[k] : static_cast<std::uint32_t>(k);
+        if (!seen[column]) {
+          seen[column] = true;
+          touched.push_back(column);
+        }
+        accumulator[column] += row.values[k];
+      }
+    }
+
+    std::sort(touched.begin(), touched.end());
+    row_values.clear();
+    for (const std::uint32_t column : touched) {
+      row_values.push_back(accumulator[column] / static_cast<double>(bucket_size));
+      accumulator[column] = 0.0;
+      seen[column] = false;
+    }
+    projection.append_sparse_row(touched, row_values, states);
+  }
+  projection.finalize(MatrixStorage::Auto);
+}
+
+std::size_t HigherOrderMarkovChain::get_order() const { return order; }
+
+std::size_t HigherOrderMarkovChain::get_context_count() const { return contexts.size(); }
+
+const TransitionMatrix &HigherOrderMarkovChain::get_projection() const { return projection; }
+
+std::size_t HigherOrderMarkovChain::get_transition_matrix_size() const { return states; }
+
+TransitionRow HigherOrderMarkovChain::get_transition_row(std::size_t state) const { return projection.row(state); }
+
+std::string HigherOrderMarkovChain::get_state_name(std::size_t state) const { return std::to_string(state); }
+
+std::size_t HigherOrderMarkovChain::context_state(std::uint64_t context) const {
+  return static_cast<std::size_t>(context % states);
+}
+
+std::uint64_t HigherOrderMarkovChain::state_context(std::size_t state) const {
+  if (state_contexts[state] == EMPTY_CONTEXT) {
+    throw std::invalid_argument("No context of the higher-order chain ends in state " + std::to_string(state) + ".");
+  }
+  return state_contexts[state];
+}
+
+std::uint64_t HigherOrderMarkovChain::sample_context(std::uint64_t context, double u) const {
+  const std::size_t next = sampler.sample(contexts.find(context), u);
+  return (context % history_modulus) * states + next;
+}
+
+std::unique_ptr<MarkovModel> load_markov_model(const fs::path &markov_file, const MatrixOptions &options) {
+  if (is_context_matrix_file(markov_file)) {
+    return std::make_unique<HigherOrderMarkovChain>(markov_file, options);
+  }
+  return std::make_unique<MarkovChain>(markov_file, options);
+}
@@ -0,0 +1,126 @@
+#include "kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MARKOV_VIDEO_SSE2 1
+#endif
+
+double dot_kernel(const double *a, const double *b, std::size_t count) {
+  std::size_t k = 0;
+  double result = 0.0;
+
+#ifdef MARKOV_VIDEO_SSE2
+  __m128d sum0 = _mm_setzero_pd();
+  __m128d sum1 = _mm_setzero_pd();
+  for (; k + 4 <= count; k += 4) {
+    sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(a + k), _mm_loadu_pd(b + k)));
+    sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(a + k + 2), _mm_loadu_pd(b + k + 2)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+  result = lanes[0] + lanes[1];
+#else
+  double sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+  for (; k + 4 <= count; k += 4) {
+    sum0 += a[k] * b[k];
+    sum1 += a[k + 1] * b[k + 1];
+    sum2 += a[k + 2] * b[k + 2];
+    sum3 += a[k + 3] * b[k + 3];
+  }
+  result = (sum0 + sum1) + (sum2 + sum3);
+#endif
+
+  for (; k < count; k++) {
+    result += a[k] * b[k];
+  }
+  return result;
+}
+
+double gather_dot_kernel(const double *values, const std::uint32_t *columns, const double *x, std::size_t count) {
+  // SSE2 has no gather, so independent accumulators are what keeps the pipeline busy.
+  std::size_t k = 0;
+  double sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+  for (; k + 4 <= count; k += 4) {
+    sum0 += values[k] * x[columns[k]];
+    sum1 += values[k + 1] * x[columns[k + 1]];
+    sum2 += values[k + 2] * x[columns[k + 2]];
+    sum3 += values[k + 3] * x[columns[k + 3]];
+  }
+  for (; k < count; k++) {
+    sum0 += values[k] * x[columns[k]];
+  }
+  return (sum0 + sum1) + (sum2 + sum3);
+}
+
+double sum_kernel(const double *values, std::size_t count) {
+  std::size_t k = 0;
+  double result = 0.0;
+
+#ifdef MARKOV_VIDEO_SSE2
+  __m128d sum0 = _mm_setzero_pd();
+  __m128d sum1 = _mm_setzero_pd();
+  for (; k + 4 <= count; k += 4) {
+    sum0 = _mm_add_pd(sum0, _mm_loadu_pd(values + k));
+    sum1 = _mm_add_pd(sum1, _mm_loadu_pd(values + k + 2));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+  result = lanes[0] + lanes[1];
+#else
+  double sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+  for (; k + 4 <= count; k += 4) {
+    sum0 += values[k];
+    sum1 += values[k + 1];
+    sum2 += values[k + 2];
+    sum3 += values[k + 3];
+  }
+  result = (sum0 + sum1) + (sum2 + sum3);
+#endif
+
+  for (; k < count; k++) {
+    result += values[k];
+  }
+  return result;
+}
+
+double min_kernel(const double *values, std::size_t count) {
+  std::size_t k = 0;
+  double result = std::numeric_limits<double>::infinity();
+
+#ifdef MARKOV_VIDEO_SSE2
+  __m128d min0 = _mm_set1_pd(result);
+  __m128d min1 = min0;
+  for (; k + 4 <= count; k += 4) {
+    min0 = _mm_min_pd(min0, _mm_loadu_pd(values + k));
+    min1 = _mm_min_pd(min1, _mm_loadu_pd(values + k + 2));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_min_pd(min0, min1));
+  result = std::min(lanes[0], lanes[1]);
+#endif
+
+  for (; k < count; k++) {
+    result = std::min(result, values[k]);
+  }
+  return result;
+}
+
+double compensated_sum_kernel(const double *values, std::size_t count) {
+  double sum = 0.0;
+  double compensation = 0.0;
+  for (std::size_t k = 0; k < count; k++) {
+    const double total = sum + values[k];
+    if (std::fabs(sum) >= std::fabs(values[k])) {
+      compensation += (sum - total) + values[k];
+    } else {
+      compensation += (values[k] - total) + sum;
+    }
+    sum = total;
+  }
+  return sum + compensation;
+}
@@ -0,0 +1,462 @@
+// Source code of the in-process video backend, which decodes, overlays and encodes the segments with libav.
+//
+// EVA License
+
+#include "libav_video.hpp"
+#include "helpers.hpp"
+#include "markov.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#ifdef MARKOV_VIDEO_LIBAV
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+}
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef MARKOV_VIDEO_LIBAV
+namespace {
+// Frame rate of the output if the first clip does not tell its own, the default of the ffmpeg CLI.
+constexpr AVRational FALLBACK_FRAME_RATE = {25, 1};
+
+struct InputContextDeleter {
+  void operator()(AVFormatContext *context) const { avformat_close_input(&context); }
+};
+struct OutputContextDeleter {
+  void operator()(AVFormatContext *context) const {
+    if (!(context->oformat->flags & AVFMT_NOFILE)) {
+      avio_closep(&context->pb);
+    }
+    avformat_free_context(context);
+  }
+};
+struct CodecContextDeleter {
+  void operator()(AVCodecContext *context) const { avcodec_free_context(&context); }
+};
+struct FrameDeleter {
+  void operator()(AVFrame *frame) const { av_frame_free(&frame); }
+};
+struct PacketDeleter {
+  void operator()(AVPacket *packet) const { av_packet_free(&packet); }
+};
+struct FilterGraphDeleter {
+  void operator()(AVFilterGraph *graph) const { avfilter_graph_free(&graph); }
+};
+struct FilterInOutDeleter {
+  void operator()(AVFilterInOut *in_out) const { avfilter_inout_free(&in_out); }
+};
+
+using FramePtr = std::unique_ptr<AVFrame, FrameDeleter>;
+using PacketPtr = std::unique_ptr<AVPacket, PacketDeleter>;
+using CodecContextPtr = std::unique_ptr<AVCodecContext, CodecContextDeleter>;
+
+std::string error_string(int error) {
+  char buffer[AV_ERROR_MAX_STRING_SIZE] = {};
+  av_strerror(error, buffer, sizeof(buffer));
+  return buffer;
+}
+
+// Throws if a libav call returned an error code.
+void check(int result, const std::string &action) {
+  if (result < 0) {
+    throw std::runtime_error(action + ": " + error_string(result));
+  }
+}
+
+FramePtr allocate_frame() {
+  FramePtr frame(av_frame_alloc());
+  if (!frame) {
+    throw std::bad_alloc();
+  }
+  return frame;
+}
+
+// Decodes the frames of the best video stream of a file. Images are read as a stream of a single frame.
+class Decoder {
+public:
+  explicit Decoder(const fs::path &file_path) : file_path(file_path.string()) {
+    AVFormatContext *context = nullptr;
+    check(avformat_open_input(&context, this->file_path.c_str(), nullptr, nullptr), "Cannot open " + this->file_path);
+    format.reset(context);
+    check(avformat_find_stream_info(format.get(), nullptr), "Cannot read the streams of " + this->file_path);
+
+    const AVCodec *codec = nullptr;
+    stream_index = av_find_best_stream(format.get(), AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    check(stream_index, "Cannot find a video stream in " + this->file_path);
+    codec_context.reset(avcodec_alloc_context3(codec));
+    packet.reset(av_packet_alloc());
+    if (!codec_context || !packet) {
+      throw std::bad_alloc();
+    }
+    check(avcodec_parameters_to_context(codec_context.get(), stream()->codecpar),
+          "Cannot read the codec of " + this->file_path);
+    check(avcodec_open2(codec_context.get(), codec, nullptr), "Cannot open the decoder of " + this->file_path);
+  }
+
+  const AVStream *stream() const { return format->streams[stream_index]; }
+  AVRational frame_rate() const {
+    return av_guess_frame_rate(format.get(), format->streams[stream_index], nullptr);
+  }
+
+  // Decodes the next frame into frame. Returns false once every frame was returned.
+  bool read(AVFrame *frame) {
+    while (true) {
+      const int received = avcodec_receive_frame(codec_context.get(), frame);
+      if (received == 0) {
+        frame->pts = frame->best_effort_timestamp;
+        return true;
+      }
+      if (received == AVERROR_EOF || (received == AVERROR(EAGAIN) && flushed)) {
+        return false;
+      }
+      if (received != AVERROR(EAGAIN)) {
+        check(received, "Cannot decode " + file_path);
+      }
+
+      // The decoder needs the next packet of the stream, or to be flushed at the end of the file.
+      const int read_result = av_read_frame(format.get(), packet.get());
+      if (read_result == AVERROR_EOF) {
+        flushed = true;
+        check(avcodec_send_packet(codec_context.get(), nullptr), "Cannot decode " + file_path);
+        continue;
+      }
+      check(read_result, "Cannot read " + file_path);
+      const int sent =
+          packet->stream_index == stream_index ? avcodec_send_packet(codec_context.get(), packet.get()) : 0;
+      av_packet_unref(packet.get());
+      check(sent, "Cannot decode " + file_path);
+    }
+  }
+
+private:
+  std::string file_path;
+  std::unique_ptr<AVFormatContext, InputContextDeleter> format;
+  CodecContextPtr codec_context;
+  PacketPtr packet;
+  int stream_index = -1;
+  bool flushed = false;
+};
+
+std::string buffer_arguments(const AVFrame &frame, AVRational time_base) {
+  const AVRational aspect =
+      frame.sample_aspect_ratio.num == 0 ? AVRational{1, 1} : frame.sample_aspect_ratio;
+  std::ostringstream arguments;
+  arguments << "video_size=" << frame.width << "x" << frame.height << ":pix_fmt=" << frame.format
+            << ":time_base=" << time_base.num << "/" << time_base.den << ":pixel_aspect=" << aspect.num << "/"
+            << aspect.den;
+  return arguments.str();
+}
+
+// Overlays a still image onto the frames of a clip with DEFAULT_OVERLAY_FILTER, then scales them to the size and pixel
+// format of the encoder. The image is the only frame of the second input, which the overlay repeats until the clip
+// ends, like a PNG input of the ffmpeg CLI.
+class Overlay {
+public:
+  Overlay(const AVFrame &first_frame, AVRational time_base, AVFrame *image, int width, int height,
+          AVPixelFormat pixel_format) {
+    graph.reset(avfilter_graph_alloc());
+    if (!graph) {
+      throw std::bad_alloc();
+    }
+    check(avfilter_graph_create_filter(&video_source, avfilter_get_by_name("buffer"), "video",
+                                       buffer_arguments(first_frame, time_base).c_str(), nullptr, graph.get()),
+          "Cannot create the video source");
+    check(avfilter_graph_create_filter(&image_source, avfilter_get_by_name("buffer"), "image",
+                                       buffer_arguments(*image, time_base).c_str(), nullptr, graph.get()),
+          "Cannot create the image source");
+    check(avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"), "out", nullptr, nullptr,
+                                       graph.get()),
+          "Cannot create the filter sink");
+
+    // The sources are the open outputs the description reads from, the sink is the open input it writes to.
+    std::unique_ptr<AVFilterInOut, FilterInOutDeleter> outputs(avfilter_inout_alloc());
+    std::unique_ptr<AVFilterInOut, FilterInOutDeleter> image_output(avfilter_inout_alloc());
+    std::unique_ptr<AVFilterInOut, FilterInOutDeleter> inputs(avfilter_inout_alloc());
+    if (!outputs || !image_output || !inputs) {
+      throw std::bad_alloc();
+    }
+    image_output->name = av_strdup("image");
+    image_output->filter_ctx = image_source;
+    outputs->name = av_strdup("video");
+    outputs->filter_ctx = video_source;
+    outputs->next = image_output.release();
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = sink;
+
+    std::ostringstream description;
+    description << "[video][image]" << constants::DEFAULT_OVERLAY_FILTER << ",scale=" << width << ":" << height
+                << ",format=" << av_get_pix_fmt_name(pixel_format) << "[out]";
+    AVFilterInOut *open_inputs = inputs.release();
+    AVFilterInOut *open_outputs = outputs.release();
+    const int parsed =
+        avfilter_graph_parse_ptr(graph.get(), description.str().c_str(), &open_inputs, &open_outputs, nullptr);
+    avfilter_inout_free(&open_inputs);
+    avfilter_inout_free(&open_outputs);
+    check(parsed, "Cannot parse the filter " + description.str());
+    check(avfilter_graph_config(graph.get(), nullptr), "Cannot configure the filter " + description.str());
+
+    image->pts = 0;
+    check(av_buffersrc_add_frame_flags(image_source, image, AV_BUFFERSRC_FLAG_KEEP_REF), "Cannot filter the image");
+    check(av_buffersrc_add_frame_flags(image_source, nullptr, 0), "Cannot filter the image");
+  }
+
+  // Adds a frame of the clip, nullptr marking its end.
+  void push(AVFrame *frame) {
+    check(av_buffersrc_add_frame_flags(video_source, frame, AV_BUFFERSRC_FLAG_KEEP_REF), "Cannot filter the clip");
+  }
+
+  // Returns the next overlaid frame, or nullptr if the filter needs more input or is done.
+  FramePtr pull() {
+    FramePtr frame = allocate_frame();
+    const int result = av_buffersink_get_frame(sink, frame.get());
+    if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+      return nullptr;
+    }
+    check(result, "Cannot filter the clip");
+    return frame;
+  }
+
+private:
+  std::unique_ptr<AVFilterGraph, FilterGraphDeleter> graph;
+  AVFilterContext *video_source = nullptr;
+  AVFilterContext *image_source = nullptr;
+  AVFilterContext *sink = nullptr;
+};
+
+// Returns the preferred pixel format of a video encoder, the first one it lists.
+AVPixelFormat encoder_pixel_format(const AVCodec *codec) {
+  const AVPixelFormat *formats = nullptr;
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+  const void *configs = nullptr;
+  int count = 0;
+  check(avcodec_get_supported_config(nullptr, codec, AV_CODEC_CONFIG_PIX_FORMAT, 0, &configs, &count),
+        "Cannot read the pixel formats of the encoder");
+  formats = count > 0 ? static_cast<const AVPixelFormat *>(configs) : nullptr;
+#else
+  formats = codec->pix_fmts;
+#endif
+  return formats != nullptr ? formats[0] : AV_PIX_FMT_YUV420P;
+}
+
+// Encodes frames into a video file with the default video codec of its container, numbering them at a constant rate.
+class Encoder {
+public:
+  Encoder(const fs::path &output_path, int width, int height, AVRational frame_rate) {
+    if (frame_rate.num <= 0 || frame_rate.den <= 0) {
+      frame_rate = FALLBACK_FRAME_RATE;
+    }
+    const std::string path = output_path.string();
+    AVFormatContext *context = nullptr;
+    check(avformat_alloc_output_context2(&context, nullptr, nullptr, path.c_str()),
+          "Cannot find a container for " + path);
+    format.reset(context);
+
+    const AVCodec *codec = avcodec_find_encoder(format->oformat->video_codec);
+    if (codec == nullptr) {
+      throw std::runtime_error("Cannot find a video encoder for " + path);
+    }
+    codec_context.reset(avcodec_alloc_context3(codec));
+    packet.reset(av_packet_alloc());
+    if (!codec_context || !packet) {
+      throw std::bad_alloc();
+    }
+    codec_context->width = width;
+    codec_context->height = height;
+    codec_context->framerate = frame_rate;
+    codec_context->time_base = av_inv_q(frame_rate);
+    codec_context->pix_fmt = encoder_pixel_format(codec);
+    if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+      codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    check(avcodec_open2(codec_context.get(), codec, nullptr), "Cannot open the encoder of " + path);
+
+    stream = avformat_new_stream(format.get(), nullptr);
+    if (stream == nullptr) {
+      throw std::bad_alloc();
+    }
+    stream->time_base = codec_context->time_base;
+    check(avcodec_parameters_from_context(stream->codecpar, codec_context.get()), "Cannot set the codec of " + path);
+    if (!(format->oformat->flags & AVFMT_NOFILE)) {
+      check(avio_open(&format->pb, path.c_str(), AVIO_FLAG_WRITE), "Cannot open " + path);
+    }
+    check(avformat_write_header(format.get(), nullptr), "Cannot write " + path);
+  }
+
+  int width() const { return codec_context->width; }
+  int height() const { return codec_context->height; }
+  AVPixelFormat pixel_format() const { return codec_context->pix_fmt; }
+
+  // Encodes frame as the next frame of the video.
+  void write(AVFrame *frame) {
+    frame->pts = next_pts++;
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    encode(frame);
+  }
+
+  // Flushes the encoder and finishes the file.
+  void finish() {
+    encode(nullptr);
+    check(av_write_trailer(format.get()), "Cannot finish the video");
+  }
+
+  std::int64_t frame_count() const { return next_pts; }
+
+private:
+  std::unique_ptr<AVFormatContext, OutputContextDeleter> format;
+  CodecContextPtr codec_context;
+  PacketPtr packet;
+  AVStream *stream = nullptr;
+  std::int64_t next_pts = 0;
+
+  void encode(AVFrame *frame) {
+    check(avcodec_send_frame(codec_context.get(), frame), "Cannot encode the video");
+    while (true) {
+      const int result = avcodec_receive_packet(codec_context.get(), packet.get());
+      if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+        return;
+      }
+      check(result, "Cannot encode the video");
+      av_packet_rescale_ts(packet.get(), codec_context->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      check(av_interleaved_write_frame(format.get(), packet.get()), "Cannot write the video");
+    }
+  }
+};
+
+// Decodes the clip, overlays the image onto it and passes every overlaid frame to on_frame in order.
+void overlay_clip(const fs::path &video_path, const fs::path &image_path, const Encoder &encoder,
+                  const std::function<void(FramePtr)> &on_frame) {
+  Decoder image_decoder(image_path);
+  FramePtr image = allocate_frame();
+  if (!image_decoder.read(image.get())) {
+    throw std::runtime_error("Cannot decode " + image_path.string());
+  }
+
+  Decoder video_decoder(video_path);
+  std::unique_ptr<Overlay> overlay;
+  FramePtr frame = allocate_frame();
+  std::int64_t first_pts = 0;
+  while (video_decoder.read(frame.get())) {
+    // The clip is shifted to start at 0 like inputs of the ffmpeg CLI, which is when the image appears.
+    if (!overlay && frame->pts != AV_NOPTS_VALUE) {
+      first_pts = frame->pts;
+    }
+    if (frame->pts != AV_NOPTS_VALUE) {
+      frame->pts -= first_pts;
+    }
+    // The filter is built from the first frame, since the decoded pixel format is only known then.
+    if (!overlay) {
+      overlay = std::make_unique<Overlay>(*frame, video_decoder.stream()->time_base, image.get(), encoder.width(),
+                                          encoder.height(), encoder.pixel_format());
+    }
+    overlay->push(frame.get());
+    av_frame_unref(frame.get());
+    for (FramePtr overlaid = overlay->pull(); overlaid; overlaid = overlay->pull()) {
+      on_frame(std::move(overlaid));
+    }
+  }
+  if (!overlay) {
+    throw std::runtime_error("Clip has no frames: " + video_path.string());
+  }
+  overlay->push(nullptr);
+  for (FramePtr overlaid = overlay->pull(); overlaid; overlaid = overlay->pull()) {
+    on_frame(std::move(overlaid));
+  }
+}
+
+std::size_t frame_bytes(const AVFrame &frame) {
+  const int size = av_image_get_buffer_size(static_cast<AVPixelFormat>(frame.format), frame.width, frame.height, 1);
+  return size > 0 ? static_cast<std::size_t>(size) : 0;
+}
+} // namespace
+
+bool libav_available() { return true; }
+
+void encode_trajectory_video(const MarkovTrajectory &markov_states, const fs::path &videos_path,
+                             const std::string &video_extension, const fs::path &images_path,
+                             const fs::path &output_path, bool verbose, std::size_t frame_cache_bytes) {
+  av_log_set_level(verbose ? AV_LOG_INFO : AV_LOG_ERROR);
+  const auto video_path = [&](std::size_t state) {
+    return videos_path / (std::to_string(state) + "." + video_extension);
+  };
+  const auto image_path = [&](std::size_t state) { return images_path / (std::to_string(state) + ".png"); };
+
+  // The output takes the size and frame rate of the clip the trajectory starts with.
+  const std::size_t first_state = *markov_states.begin();
+  std::unique_ptr<Encoder> encoder;
+  {
+    const Decoder first_clip(video_path(first_state));
+    encoder = std::make_unique<Encoder>(output_path, first_clip.stream()->codecpar->width,
+                                        first_clip.stream()->codecpar->height, first_clip.frame_rate());
+  }
+
+  // Overlaid frames of the clips decoded so far, kept while they fit in frame_cache_bytes.
+  std::unordered_map<std::size_t, std::vector<FramePtr>> cached_frames;
+  std::size_t cached_bytes = 0;
+  std::size_t decoded_count = 0;
+  std::cout << "Encoding the trajectory into " << output_path << "." << std::endl;
+  for (std::size_t state : markov_states) {
+    const auto cached = cached_frames.find(state);
+    if (cached != cached_frames.end()) {
+      for (const FramePtr &frame : cached->second) {
+        encoder->write(frame.get());
+      }
+      continue;
+    }
+
+    if (verbose) {
+      std::cout << "Decoding " << video_path(state) << "." << std::endl;
+    }
+    decoded_count++;
+    std::vector<FramePtr> frames;
+    std::size_t clip_bytes = 0;
+    bool keep = true;
+    overlay_clip(video_path(state), image_path(state), *encoder, [&](FramePtr frame) {
+      encoder->write(frame.get());
+      if (!keep) {
+        return;
+      }
+      clip_bytes += frame_bytes(*frame);
+      if (cached_bytes + clip_bytes > frame_cache_bytes) {
+        keep = false;
+        frames.clear();
+        return;
+      }
+      frames.push_back(std::move(frame));
+    });
+    if (keep) {
+      cached_bytes += clip_bytes;
+      cached_frames.emplace(state, std::move(frames));
+    }
+  }
+  encoder->finish();
+  std::cout << "Encoded " << encoder->frame_count() << " frames, decoding " << decoded_count << " clips." << std::endl;
+}
+#else
+bool libav_available() { return false; }
+
+void encode_trajectory_video(const MarkovTrajectory &, const fs::path &, const std::string &, const fs::path &,
+                             const fs::path &, bool, std::size_t) {
+  throw std::runtime_error("markov-video was built without libav, rebuild it with make LIBAV=1.");
+}
+#endif
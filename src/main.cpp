@@ -1,15 +1,37 @@
+#include "analytics.hpp"
+#include "artifact_cache.hpp"
 #include "argparse.hpp"
+#include "ffmpeg.hpp"
+#include "graph_layout.hpp"
 #include "helpers.hpp"
+#include "higher_order_markov.hpp"
+#include "libav_video.hpp"
 #include "markov.hpp"
 #include "markov_processor.hpp"
+#include "parallel.hpp"
+#include "process.hpp"
+#include "transition_matrix.hpp"
+#include "visuals.hpp"
+#include <chrono>
+#include <csignal>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
 namespace fs = std::filesystem;
 
+namespace {
+// Cancels the running commands on the first interrupt, a second one stops markov-video at once.
+void cancel_commands(int signal_number) {
+  ProcessExecutor::global().cancel();
+  std::signal(signal_number, SIG_DFL);
+}
+} // namespace
+
 int main(int argc, char *argv[]) {
   argparse::ArgumentParser program("markov-video", "0.1");
   auto &video_or_gif = program.add_mutually_exclusive_group();
@@ -18,17 +40,97 @@ int main(int argc, char *argv[]) {
 
   program.add_argument("--verbose").flag().help("enable output for ffmpeg, latex and ImageMagick.");
   program.add_argument("-m", "--markov-file").required().help("specify the file which contains the markov chain.");
-  program.add_argument("-o", "--output-file").required().help("specify the output file path.");
+  program.add_argument("-o", "--output-file").help("specify the output file path.");
   video_or_gif.add_argument("-V", "--videos-folder").help("specify the folder which contains the video segments.");
   video_or_gif.add_argument("-G", "--is-gif").flag().help("specify if output will be a gif. (NYI)");
+  program.add_argument("-ms", "--matrix-storage")
+      .default_value(std::string("auto"))
+      .choices("auto", "dense", "sparse")
+      .help("specify how the transition matrix is stored, sparse chains use less memory with sparse.");
+  program.add_argument("-n", "--normalize")
+      .flag()
+      .help("rescale the rows of the transition matrix so that they sum to 1 before validating it.");
   program.add_argument("-i", "--iterations")
       .scan<'i', std::size_t>()
       .help("specify the number of iterations for the markov chain.");
+  program.add_argument("-a", "--analyze")
+      .flag()
+      .help("print the stationary distribution, n-step probabilities (n from -i), hitting times and mixing time of the "
+            "markov chain, or write them as JSON to the output file if given.");
+  program.add_argument("-ht", "--hitting-target")
+      .default_value(std::size_t{0})
+      .scan<'u', std::size_t>()
+      .help("specify the state whose expected hitting times --analyze reports.");
+  program.add_argument("-tb", "--to-binary")
+      .flag()
+      .help("convert the markov file into the binary matrix format at the output file path and exit.");
+  program.add_argument("-s", "--seed")
+      .scan<'u', std::uint64_t>()
+      .help("specify the seed of the markov chain so that the same output can be created again.");
   program.add_argument("-b", "--build-folder").help("specify the folder which will contain the auxillary files.");
+  program.add_argument("-cd", "--cache-dir")
+      .help("specify a folder that keeps graphs and overlaid segments between runs, so unchanged ones are reused.");
+  program.add_argument("-cs", "--cache-size")
+      .default_value(constants::DEFAULT_CACHE_SIZE_MB)
+      .scan<'u', std::size_t>()
+      .help("specify the size of the cache folder in MiB, the least recently used files are removed beyond it.");
   program.add_argument("-nc", "--no-cleanup").flag().help("disables removing auxillary files and folders.");
   program.add_argument("-el", "--edit-latex")
       .flag()
       .help("prompts user to press enter after creating the latex files.");
+  program.add_argument("-j", "--jobs")
+      .default_value(hardware_threads())
+      .scan<'u', std::size_t>()
+      .help("specify how many latex files are compiled, pdfs are rasterized, graphs are rendered or segments are "
+            "overlaid at once.");
+  program.add_argument("-ft", "--ffmpeg-threads")
+      .default_value(std::size_t{0})
+      .scan<'u', std::size_t>()
+      .help("specify how many threads every ffmpeg overlay uses, fewer overlays run at once so that they fit the "
+            "cores. 0 splits the cores between the overlays.");
+  program.add_argument("-ct", "--command-timeout")
+      .default_value(std::size_t{0})
+      .scan<'u', std::size_t>()
+      .help("specify how many seconds latex, ImageMagick and ffmpeg may run each before they are stopped, 0 for no "
+            "limit.");
+  program.add_argument("-sd", "--single-document")
+      .flag()
+      .help("write every graph as a page of a single latex document, which is compiled only once.");
+  program.add_argument("-r", "--renderer")
+      .default_value(std::string("latex"))
+      .choices("latex", "native")
+      .help("specify how the graphs are drawn, native draws them without latex and ImageMagick.");
+  program.add_argument("-vb", "--video-backend")
+      .default_value(std::string("cli"))
+      .choices("cli", "libav")
+      .help("specify how the video is made, libav overlays and encodes it in-process without intermediate segments "
+            "(needs a build with LIBAV=1).");
+  program.add_argument("-gf", "--gif-fps")
+      .default_value(constants::DEFAULT_GIF_FPS)
+      .scan<'u', std::size_t>()
+      .help("specify the frame rate of the gif.");
+  program.add_argument("-gw", "--gif-width")
+      .default_value(constants::DEFAULT_GIF_WIDTH)
+      .scan<'u', std::size_t>()
+      .help("specify the width of the gif in pixels, the height follows from the graphs.");
+  program.add_argument("-l", "--layout")
+      .default_value(std::string("auto"))
+      .choices("auto", "grid", "force", "layered")
+      .help("specify how the states are placed, auto keeps the grid up to 12 states and uses layered or force beyond.");
+  program.add_argument("-pt", "--prune-threshold")
+      .default_value(0.0)
+      .scan<'g', double>()
+      .help("specify the probability below which transitions are left out of the graphs.");
+  program.add_argument("-be", "--bundle-edges")
+      .flag()
+      .help("merge edges between the same regions of the graph into unlabeled bundles.");
+  program.add_argument("-dpi", "--dpi")
+      .default_value(constants::DEFAULT_RASTER_DPI)
+      .scan<'g', double>()
+      .help("specify the resolution the latex graphs are rasterized at, in pixels per inch.");
+  program.add_argument("-iw", "--image-width")
+      .scan<'u', std::size_t>()
+      .help("specify the width of the latex graphs in pixels, replacing --dpi.");
   program.add_argument("-lc", "--latex-compiler")
       .default_value(std::string(constants::DEFAULT_LATEX_COMPILER))
       .help("specify the latex compiler which will compile the .tex files.");
@@ -50,56 +152,136 @@ int main(int argc, char *argv[]) {
 
   try {
     program.parse_args(argc, argv);
+    if (!program.is_used("-a") && !program.is_used("-o")) {
+      std::cerr << "-o required unless using --analyze" << std::endl;
+      std::cerr << program;
+      return 1;
+    }
     if ((program.is_used("-V") || program.is_used("-G")) && !program.is_used("-i")) {
       std::cerr << "-i required when using -V or -G" << std::endl;
       std::cerr << program;
       return 1;
     }
+    if (program.get<double>("-dpi") <= 0 || (program.is_used("-iw") && program.get<std::size_t>("-iw") == 0)) {
+      std::cerr << "--dpi and --image-width must be positive" << std::endl;
+      std::cerr << program;
+      return 1;
+    }
+    if (program.get<std::size_t>("-gf") == 0 || program.get<std::size_t>("-gw") == 0) {
+      std::cerr << "--gif-fps and --gif-width must be positive" << std::endl;
+      std::cerr << program;
+      return 1;
+    }
+    if (program.get("-vb") == "libav" && !libav_available()) {
+      std::cerr << "--video-backend libav needs markov-video to be built with LIBAV=1" << std::endl;
+      return 1;
+    }
   } catch (const std::runtime_error &err) {
     std::cerr << err.what() << std::endl;
     std::cerr << program;
     return 1;
   }
 
-  const fs::path &markov_file = program.get("-m");
-  const fs::path &output_path = program.get("-o");
-  const fs::path &latex_output_directory = program.get("-lod");
-  const fs::path &filelist_path = program.get("-flp");
+  try {
+    const fs::path &markov_file = program.get("-m");
+    const fs::path &output_path = program.is_used("-o") ? fs::path(program.get("-o")) : fs::path();
+    const fs::path &latex_output_directory = program.get("-lod");
+    const fs::path &filelist_path = program.get("-flp");
 
-  const std::string &file_extension = program.get("-fe");
-  const std::string &latex_compiler = program.get("-lc");
-  const std::string &latex_compiler_options = program.get("-lco");
-  const std::string &overlay_extension = program.get("-oe");
+    const std::string &file_extension = program.get("-fe");
+    const std::string &latex_compiler = program.get("-lc");
+    const std::string &latex_compiler_options = program.get("-lco");
+    const std::string &overlay_extension = program.get("-oe");
+    MatrixOptions matrix_options;
+    matrix_options.storage = matrix_storage_from_string(program.get("-ms"));
+    matrix_options.normalize = program.get<bool>("-n");
 
-  const bool verbose = program.get<bool>("--verbose");
-  const bool no_cleanup = program.get<bool>("-nc");
-  const bool edit_latex = program.get<bool>("-el");
+    const bool verbose = program.get<bool>("--verbose");
+    const bool no_cleanup = program.get<bool>("-nc");
+    const bool edit_latex = program.get<bool>("-el");
+    const std::size_t jobs = program.get<std::size_t>("-j");
+    const std::size_t ffmpeg_threads = program.get<std::size_t>("-ft");
+    // -j also bounds the commands that run at once across every stage.
+    ProcessExecutor::global().set_max_processes(jobs);
+    ProcessExecutor::global().set_default_timeout(std::chrono::seconds(program.get<std::size_t>("-ct")));
+    const bool single_document = program.get<bool>("-sd");
+    const GraphRenderer renderer = graph_renderer_from_string(program.get("-r"));
+    const VideoBackend video_backend = video_backend_from_string(program.get("-vb"));
+    LayoutOptions layout_options;
+    layout_options.algorithm = layout_algorithm_from_string(program.get("-l"));
+    layout_options.prune_threshold = program.get<double>("-pt");
+    layout_options.bundle_edges = program.get<bool>("-be");
+    GifOptions gif_options;
+    gif_options.fps = program.get<std::size_t>("-gf");
+    gif_options.width = program.get<std::size_t>("-gw");
+    RasterOptions raster_options;
+    raster_options.dpi = program.get<double>("-dpi");
+    if (program.is_used("-iw"))
+      raster_options.width = program.get<std::size_t>("-iw");
 
-  const fs::path &build_folder = program.is_used("-b")
-                                     ? fs::path(program.get("-b"))
-                                     : fs::path(std::string(constants::DEFAULT_BUILD_DIRECTORY) + get_timestamp());
+    const fs::path &build_folder = program.is_used("-b")
+                                       ? fs::path(program.get("-b"))
+                                       : fs::path(std::string(constants::DEFAULT_BUILD_DIRECTORY) + get_timestamp());
 
-  MarkovChain mc(markov_file);
-  MarkovProcessor processor(mc, build_folder, output_path, latex_output_directory, filelist_path, file_extension,
-                            overlay_extension, latex_compiler, latex_compiler_options, edit_latex, verbose, no_cleanup);
+    const std::unique_ptr<MarkovModel> model = load_markov_model(markov_file, matrix_options);
+    const MarkovChain *first_order = dynamic_cast<const MarkovChain *>(model.get());
+    if ((program.get<bool>("-a") || program.get<bool>("-tb")) && first_order == nullptr) {
+      std::cerr << "--analyze and --to-binary only support first-order chains" << std::endl;
+      return 1;
+    }
+    if (program.get<bool>("-a")) {
+      const std::size_t n_steps = program.is_used("-i") ? program.get<std::size_t>("-i") : 1;
+      const MarkovAnalysis analysis = analyze_markov_chain(*first_order, n_steps, program.get<std::size_t>("-ht"));
+      if (program.is_used("-o")) {
+        write_markov_analysis_json(analysis, *first_order, output_path);
+        std::cout << "Wrote analysis " << output_path << "." << std::endl;
+      } else {
+        print_markov_analysis(analysis, *first_order, std::cout);
+      }
+      return 0;
+    }
+    if (program.get<bool>("-tb")) {
+      first_order->get_transition_matrix().write_binary(output_path);
+      std::cout << "Wrote binary matrix " << output_path << "." << std::endl;
+      return 0;
+    }
+    if (program.is_used("-s"))
+      model->set_seed(program.get<std::uint64_t>("-s"));
+    std::cout << "Using seed " << model->get_seed() << "." << std::endl;
 
-  ProcessingMode mode = determine_processing_mode(program.is_used("-V"), program.is_used("-G"));
+    std::unique_ptr<ArtifactCache> cache;
+    if (program.is_used("-cd"))
+      cache = std::make_unique<ArtifactCache>(fs::path(program.get("-cd")),
+                                              std::uintmax_t{program.get<std::size_t>("-cs")} << 20);
 
-  switch (mode) {
-  case ProcessingMode::Video: {
-    const fs::path &video_folder = program.get("-V");
-    const std::size_t iterations = program.get<std::size_t>("-i");
-    processor.video(video_folder, iterations);
-    return 0;
-  }
-  case ProcessingMode::GIF: {
-    const std::size_t iterations = program.get<std::size_t>("-i");
-    processor.gif(iterations);
-    return 0;
-  }
-  case ProcessingMode::BuildOnly:
-    processor.build_only();
-    return 0;
+    MarkovProcessor processor(*model, build_folder, output_path, latex_output_directory, filelist_path, file_extension,
+                              overlay_extension, latex_compiler, latex_compiler_options, edit_latex, verbose,
+                              no_cleanup, jobs, single_document, renderer, cache.get(), raster_options, layout_options,
+                              ffmpeg_threads, video_backend, gif_options);
+
+    ProcessingMode mode = determine_processing_mode(program.is_used("-V"), program.is_used("-G"));
+
+    std::signal(SIGINT, cancel_commands);
+    std::signal(SIGTERM, cancel_commands);
+    switch (mode) {
+    case ProcessingMode::Video: {
+      const fs::path &video_folder = program.get("-V");
+      const std::size_t iterations = program.get<std::size_t>("-i");
+      processor.video(video_folder, iterations);
+      return 0;
+    }
+    case ProcessingMode::GIF: {
+      const std::size_t iterations = program.get<std::size_t>("-i");
+      processor.gif(iterations);
+      return 0;
+    }
+    case ProcessingMode::BuildOnly:
+      processor.build_only();
+      return 0;
+    }
+  } catch (const std::exception &err) {
+    std::cerr << err.what() << std::endl;
+    return 1;
   }
 
   return 0;
@@ -0,0 +1,104 @@
+#include "mapped_file.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef _WIN32
+MappedFile::MappedFile(const fs::path &file_path) {
+  file_handle = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    file_handle = nullptr;
+    throw std::runtime_error("Could not open file: " + file_path.string());
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_handle, &file_size)) {
+    CloseHandle(file_handle);
+    throw std::runtime_error("Could not read the size of file: " + file_path.string());
+  }
+  mapped_size = static_cast<std::size_t>(file_size.QuadPart);
+  if (mapped_size == 0) {
+    return;
+  }
+
+  mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_handle == nullptr) {
+    CloseHandle(file_handle);
+    throw std::runtime_error("Could not map file: " + file_path.string());
+  }
+  mapped_data = static_cast<const char *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+  if (mapped_data == nullptr) {
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+    throw std::runtime_error("Could not map file: " + file_path.string());
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (mapped_data)
+    UnmapViewOfFile(mapped_data);
+  if (mapping_handle)
+    CloseHandle(mapping_handle);
+  if (file_handle)
+    CloseHandle(file_handle);
+}
+#else
+MappedFile::MappedFile(const fs::path &file_path) {
+  const int file_descriptor = open(file_path.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    throw std::runtime_error("Could not open file: " + file_path.string());
+  }
+
+  struct stat file_status;
+  if (fstat(file_descriptor, &file_status) != 0) {
+    close(file_descriptor);
+    throw std::runtime_error("Could not read the size of file: " + file_path.string());
+  }
+  mapped_size = static_cast<std::size_t>(file_status.st_size);
+  if (mapped_size == 0) {
+    close(file_descriptor);
+    return;
+  }
+
+  void *address = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  // The mapping stays valid after the file descriptor is closed.
+  close(file_descriptor);
+  if (address == MAP_FAILED) {
+    throw std::runtime_error("Could not map file: " + file_path.string());
+  }
+  mapped_data = static_cast<const char *>(address);
+  // Text files are parsed and binary files validated from front to back.
+  advise(Access::Sequential);
+}
+
+MappedFile::~MappedFile() {
+  if (mapped_data)
+    munmap(const_cast<char *>(mapped_data), mapped_size);
+}
+#endif
+
+const char *MappedFile::data() const { return mapped_data; }
+
+std::size_t MappedFile::size() const { return mapped_size; }
+
+void MappedFile::advise([[maybe_unused]] Access access) const {
+#ifndef _WIN32
+  if (mapped_data)
+    madvise(const_cast<char *>(mapped_data), mapped_size,
+            access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+}
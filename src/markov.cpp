@@ -4,91 +4,123 @@
 
 #include "markov.hpp"
 #include "helpers.hpp"
-#include <algorithm>
-#include <cmath>
+#include "parallel.hpp"
+#include "philox.hpp"
 #include <cstddef>
-#include <fstream>
+#include <cstdint>
 #include <iostream>
-#include <iterator>
 #include <random>
-#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 namespace fs = std::filesystem;
 
-MarkovChain::MarkovChain(const std::vector<std::vector<double>> &transition_matrix)
-    : transition_matrix(transition_matrix), current_state(0), generator(std::random_device{}()) {
+namespace {
+std::uint64_t random_seed() {
+  std::random_device device;
+  return (static_cast<std::uint64_t>(device()) << 32) | device();
+}
+} // namespace
+
+MarkovModel::MarkovModel() : current_context(0), seed(random_seed()), step(0) {}
+
+void MarkovModel::set_current_state(std::size_t state) {
+  if (state >= get_transition_matrix_size()) {
+    throw std::out_of_range("State index out of range.");
+  }
+  current_context = state_context(state);
+}
+
+std::size_t MarkovModel::get_current_state() const { return context_state(current_context); }
+
+std::size_t MarkovModel::next_state() {
+  current_context = next_context(current_context, 0, step++);
+  return context_state(current_context);
+}
+
+std::uint64_t MarkovModel::next_context(std::uint64_t context, std::uint64_t stream, std::uint64_t index) const {
+  return sample_context(context, philox_uniform(seed, stream, index));
+}
+
+std::uint64_t MarkovModel::get_current_context() const { return current_context; }
+
+std::size_t MarkovModel::context_state(std::uint64_t context) const { return static_cast<std::size_t>(context); }
+
+void MarkovModel::set_current_context(std::uint64_t context) { current_context = context; }
+
+std::uint64_t MarkovModel::state_context(std::size_t state) const { return state; }
+
+MarkovTrajectory MarkovModel::trajectory(std::size_t iterations) const {
+  return MarkovTrajectory(*this, current_context, iterations, 0, step);
+}
+
+void MarkovModel::set_seed(std::uint64_t seed) {
+  this->seed = seed;
+  step = 0;
+}
+
+std::uint64_t MarkovModel::get_seed() const { return seed; }
+
+MarkovChain::MarkovChain(const std::vector<std::vector<double>> &transition_matrix, const MatrixOptions &options)
+    : transition_matrix(transition_matrix, options.storage) {
+  prepare_transition_matrix(options);
   validate_transition_matrix();
+  build_sampler();
   linear_state_names();
 }
 
 MarkovChain::MarkovChain(const std::vector<std::vector<double>> &transition_matrix,
-                         const std::vector<std::string> &state_names)
-    : transition_matrix(transition_matrix), state_names(state_names), current_state(0),
-      generator(std::random_device{}()) {
+                         const std::vector<std::string> &state_names, const MatrixOptions &options)
+    : transition_matrix(transition_matrix, options.storage), state_names(state_names) {
+  prepare_transition_matrix(options);
   validate_transition_matrix();
+  build_sampler();
   validate_state_names();
 }
 
-MarkovChain::MarkovChain(const fs::path &markov_file) : current_state(0), generator(std::random_device{}()) {
-  transition_matrix_from_file(markov_file);
+MarkovChain::MarkovChain(const fs::path &markov_file, const MatrixOptions &options) {
+  transition_matrix_from_file(markov_file, options.storage);
+  prepare_transition_matrix(options);
   validate_transition_matrix();
+  build_sampler();
   linear_state_names();
 }
 
-MarkovChain::MarkovChain(const fs::path &markov_file, const std::vector<std::string> &state_names)
-    : state_names(state_names), current_state(0), generator(std::random_device{}()) {
-  transition_matrix_from_file(markov_file);
+MarkovChain::MarkovChain(const fs::path &markov_file, const std::vector<std::string> &state_names,
+                         const MatrixOptions &options)
+    : state_names(state_names) {
+  transition_matrix_from_file(markov_file, options.storage);
+  prepare_transition_matrix(options);
   validate_transition_matrix();
+  build_sampler();
   validate_state_names();
 }
 
-void MarkovChain::validate_transition_matrix() const {
-  std::size_t matrix_length = transition_matrix.size();
-  for (const auto &row : transition_matrix) {
-    if (row.size() != matrix_length) {
-      throw std::invalid_argument("Transition matrix is not a square matrix.");
-    }
-    double sum = constants::ZERO;
-    for (double prob : row) {
-      if (prob < constants::ZERO) {
-        throw std::invalid_argument("Transition matrix probabilities must be non-negative.");
-      }
-      sum += prob;
-    }
-    // Have to use this due to floating point arithmetic.
-    if (std::fabs(sum - constants::ONE) > constants::EPSILON) {
-      throw std::invalid_argument("Transition probabilities must sum to 1.");
-    }
+void MarkovChain::prepare_transition_matrix(const MatrixOptions &options) {
+  if (options.normalize) {
+    transition_matrix.normalize_rows();
   }
 }
 
-void MarkovChain::transition_matrix_from_file(const fs::path &markov_file) {
-  std::ifstream mc_file(markov_file);
-  if (!mc_file.is_open()) {
-    throw std::invalid_argument("Could not read markov chain file.");
+void MarkovChain::validate_transition_matrix() const {
+  if (transition_matrix.column_count() != transition_matrix.size()) {
+    throw std::invalid_argument("Transition matrix is not a square matrix.");
   }
 
-  std::size_t lines = std::count(std::istreambuf_iterator<char>(mc_file), std::istreambuf_iterator<char>(), '\n');
-  transition_matrix.resize(lines);
-
-  mc_file.clear();  // resets the pointer location and any errors.
-  mc_file.seekg(0); // average cpp moment
-
-  std::string line;
-  std::size_t transition_matrix_index = 0;
+  throw_if_invalid_rows(transition_matrix, constants::EPSILON);
+}
 
-  while (std::getline(mc_file, line)) {
-    std::stringstream ss(line);
-    std::string probability_value;
-    while (std::getline(ss, probability_value, ',')) {
-      transition_matrix[transition_matrix_index].push_back(std::stod(probability_value));
-    }
-    transition_matrix_index++;
+void MarkovChain::build_sampler() {
+  sampler.clear();
+  for (std::size_t i = 0; i < transition_matrix.size(); i++) {
+    const TransitionRow row = transition_matrix.row(i);
+    sampler.add_row(row.values, row.columns, row.count);
   }
-  mc_file.close();
+}
+
+void MarkovChain::transition_matrix_from_file(const fs::path &markov_file, MatrixStorage storage) {
+  transition_matrix = read_transition_matrix(markov_file, storage);
 }
 
 void MarkovChain::linear_state_names() {
@@ -106,30 +138,20 @@ void MarkovChain::validate_state_names() const {
   }
 }
 
-void MarkovChain::set_current_state(std::size_t state) {
-  if (state >= transition_matrix.size()) {
-    throw std::out_of_range("State index out of range.");
-  }
-  current_state = state;
-}
-
-std::size_t MarkovChain::get_current_state() const { return current_state; }
-
-std::size_t MarkovChain::next_state() {
-  std::discrete_distribution<int> distribution(transition_matrix[current_state].begin(),
-                                               transition_matrix[current_state].end());
-  current_state = distribution(generator);
-  return current_state;
+std::uint64_t MarkovChain::sample_context(std::uint64_t context, double u) const {
+  return sampler.sample(static_cast<std::size_t>(context), u);
 }
 
-const std::vector<std::vector<double>> &MarkovChain::get_transition_matrix() const { return transition_matrix; }
+const TransitionMatrix &MarkovChain::get_transition_matrix() const { return transition_matrix; }
 
 std::size_t MarkovChain::get_transition_matrix_size() const { return transition_matrix.size(); }
 
+TransitionRow MarkovChain::get_transition_row(std::size_t state) const { return transition_matrix.row(state); }
+
 void MarkovChain::view_transition_matrix() const {
-  for (const auto &row : transition_matrix) {
-    for (double prob : row) {
-      std::cout << prob << " ";
+  for (std::size_t i = 0; i < transition_matrix.size(); i++) {
+    for (std::size_t j = 0; j < transition_matrix.column_count(); j++) {
+      std::cout << transition_matrix.probability(i, j) << " ";
     }
     std::cout << std::endl;
   }
@@ -137,13 +159,74 @@ void MarkovChain::view_transition_matrix() const {
 
 const std::vector<std::string> &MarkovChain::get_state_names() const { return state_names; }
 
+std::string MarkovChain::get_state_name(std::size_t state) const { return state_names[state]; }
+
 void MarkovChain::view_state_names() const {
   for (const std::string &state : state_names) {
     std::cout << state << std::endl;
   }
 }
 
-std::vector<std::size_t> iterate_markov_states(MarkovChain &mc, std::size_t iterations) {
+MarkovTrajectory::iterator::iterator(const MarkovTrajectory *trajectory, std::uint64_t context)
+    : trajectory(trajectory), context(context), state(trajectory->mc.context_state(context)), position(0),
+      done(false) {}
+
+MarkovTrajectory::iterator &MarkovTrajectory::iterator::operator++() {
+  if (position == trajectory->iterations) {
+    done = true;
+  } else {
+    context = trajectory->mc.next_context(context, trajectory->stream, trajectory->first_index + position);
+    state = trajectory->mc.context_state(context);
+    position++;
+  }
+  return *this;
+}
+
+MarkovTrajectory::iterator MarkovTrajectory::iterator::operator++(int) {
+  iterator previous = *this;
+  ++*this;
+  return previous;
+}
+
+bool MarkovTrajectory::iterator::operator==(const iterator &other) const {
+  if (done || other.done) {
+    return done == other.done;
+  }
+  return trajectory == other.trajectory && position == other.position;
+}
+
+MarkovTrajectory::MarkovTrajectory(const MarkovModel &mc, std::uint64_t start_context, std::size_t iterations,
+                                   std::uint64_t stream, std::uint64_t first_index)
+    : mc(mc), start_context(start_context), iterations(iterations), stream(stream), first_index(first_index) {}
+
+MarkovTrajectory::iterator MarkovTrajectory::begin() const { return iterator(this, start_context); }
+
+MarkovTrajectory::iterator MarkovTrajectory::end() const { return iterator(); }
+
+std::size_t MarkovTrajectory::get_iterations() const { return iterations; }
+
+std::vector<std::size_t> MarkovTrajectory::visited_states() const {
+  const std::size_t state_count = mc.get_transition_matrix_size();
+  std::vector<bool> visited(state_count, false);
+  std::size_t visited_count = 0;
+  for (auto it = begin(); it != end() && visited_count < state_count; ++it) {
+    if (!visited[*it]) {
+      visited[*it] = true;
+      visited_count++;
+    }
+  }
+
+  std::vector<std::size_t> states;
+  states.reserve(visited_count);
+  for (std::size_t state = 0; state < state_count; state++) {
+    if (visited[state]) {
+      states.push_back(state);
+    }
+  }
+  return states;
+}
+
+std::vector<std::size_t> iterate_markov_states(MarkovModel &mc, std::size_t iterations) {
   std::vector<std::size_t> markov_iterations;
   markov_iterations.push_back(mc.get_current_state());
   for (std::size_t i = 0; i < iterations; i++) {
@@ -151,3 +234,22 @@ std::vector<std::size_t> iterate_markov_states(MarkovChain &mc, std::size_t iter
   }
   return markov_iterations;
 }
+
+std::vector<std::vector<std::size_t>> iterate_markov_trajectories(const MarkovModel &mc, std::size_t trajectory_count,
+                                                                  std::size_t iterations, std::size_t thread_count) {
+  std::vector<std::vector<std::size_t>> trajectories(trajectory_count);
+
+  parallel_for(trajectory_count, thread_count, [&](std::size_t stream) {
+    std::vector<std::size_t> &trajectory = trajectories[stream];
+    trajectory.reserve(iterations + 1);
+
+    std::uint64_t context = mc.get_current_context();
+    trajectory.push_back(mc.context_state(context));
+    for (std::size_t i = 0; i < iterations; i++) {
+      context = mc.next_context(context, stream, i);
+      trajectory.push_back(mc.context_state(context));
+    }
+  });
+
+  return trajectories;
+}
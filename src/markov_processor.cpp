@@ -1,99 +1,393 @@
 #include "markov_processor.hpp"
+#include "artifact_cache.hpp"
 #include "ffmpeg.hpp"
+#include "graph_layout.hpp"
 #include "helpers.hpp"
+#include "libav_video.hpp"
 #include "markov.hpp"
+#include "native_renderer.hpp"
+#include "parallel.hpp"
+#include "task_graph.hpp"
 #include "visuals.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace fs = std::filesystem;
 
-MarkovProcessor::MarkovProcessor(MarkovChain &mc, const fs::path &build_folder, const fs::path &output_path,
+MarkovProcessor::MarkovProcessor(MarkovModel &mc, const fs::path &build_folder, const fs::path &output_path,
                                  const fs::path &latex_output_directory, const fs::path &filelist_path,
                                  const std::string &file_extension, const std::string &overlay_extension,
                                  const std::string &latex_compiler, const std::string &latex_compiler_options,
-                                 bool edit_latex, bool verbose, bool no_cleanup)
+                                 bool edit_latex, bool verbose, bool no_cleanup, std::size_t jobs, bool single_document,
+                                 GraphRenderer renderer, const ArtifactCache *cache,
+                                 const RasterOptions &raster_options, const LayoutOptions &layout_options,
+                                 std::size_t ffmpeg_threads, VideoBackend video_backend, const GifOptions &gif_options)
     : mc(mc), build_folder(build_folder), output_path(output_path), latex_output_directory(latex_output_directory),
       filelist_path(filelist_path), file_extension(file_extension), overlay_extension(overlay_extension),
       latex_compiler(latex_compiler), latex_compiler_options(latex_compiler_options), edit_latex(edit_latex),
-      verbose(verbose), no_cleanup(no_cleanup) {}
+      verbose(verbose), no_cleanup(no_cleanup), jobs(jobs), ffmpeg_threads(ffmpeg_threads),
+      single_document(single_document), renderer(renderer), cache(cache), raster_options(raster_options),
+      layout_options(layout_options), video_backend(video_backend), gif_options(gif_options) {}
+
+namespace {
+std::mutex output_mutex;
+
+// Prints the parts as one line, so that the lines of tasks running at once never interleave.
+template <typename... Parts> void print_line(const Parts &...parts) {
+  std::lock_guard<std::mutex> lock(output_mutex);
+  (std::cout << ... << parts) << std::endl;
+}
+
+// What the graph tasks of a run share. The layout task fills it in, and every task holding it keeps it alive.
+struct GraphResources {
+  std::unique_ptr<const GraphLayout> layout;
+  std::unique_ptr<const MarkovGraphPicture> picture;
+  std::unique_ptr<const NativeGraphRenderer> renderer;
+};
+
+std::vector<TaskGraph::TaskId> flatten(const std::vector<std::vector<TaskGraph::TaskId>> &task_lists) {
+  std::vector<TaskGraph::TaskId> tasks;
+  for (const std::vector<TaskGraph::TaskId> &task_list : task_lists) {
+    tasks.insert(tasks.end(), task_list.begin(), task_list.end());
+  }
+  return tasks;
+}
+} // namespace
 
 void MarkovProcessor::video(const fs::path &video_folder, std::size_t iterations) const {
   const std::size_t &transition_matrix_size = mc.get_transition_matrix_size();
-  const auto &markov_states = iterate_markov_states(mc, iterations);
+  const MarkovTrajectory markov_states = mc.trajectory(iterations);
+
+  // States the trajectory never reaches are not part of the video, so their graphs are not drawn or overlaid.
+  const std::vector<std::size_t> visited_states = markov_states.visited_states();
+  std::cout << "The trajectory visits " << visited_states.size() << " of " << transition_matrix_size
+            << " states, skipping the graphs and overlays of " << transition_matrix_size - visited_states.size()
+            << "." << std::endl;
 
   create_dir(build_folder);
-  generate_all_markov_graphs(mc, build_folder);
+  TaskGraph graph;
+  const std::vector<std::vector<TaskGraph::TaskId>> graph_tasks = add_graph_tasks(graph, visited_states, build_folder);
+  if (video_backend == VideoBackend::Libav) {
+    graph.add(
+        "encode " + output_path.filename().string(),
+        [&] {
+          encode_trajectory_video(markov_states, video_folder, file_extension, build_folder, output_path, verbose,
+                                  constants::DEFAULT_FRAME_CACHE_MB << 20);
+        },
+        flatten(graph_tasks));
+    graph.run(jobs);
+  } else {
+    // Ensure the input file exists
+    if (!fs::exists(video_folder)) {
+      throw std::runtime_error("Input videos folder does not exist: " + video_folder.string());
+    }
+    // The filelist only depends on the trajectory, so the repeated segments it names are known before any is made.
+    const std::vector<std::uint64_t> repeat_masks =
+        create_filelist(markov_states, build_folder / filelist_path, overlay_extension, file_extension);
+
+    const std::size_t clip_count = visited_states.size();
+    const fs::path &normalized_folder = build_folder / constants::DEFAULT_NORMALIZED_DIRECTORY;
+    std::vector<fs::path> clip_paths(clip_count);
+    std::vector<ClipProfile> profiles(clip_count);
+    ClipProfile canonical;
+
+    std::vector<TaskGraph::TaskId> probe_tasks;
+    for (std::size_t i = 0; i < clip_count; i++) {
+      clip_paths[i] = video_folder / (std::to_string(visited_states[i]) + "." + file_extension);
+      probe_tasks.push_back(graph.add("probe " + clip_paths[i].filename().string(),
+                                      [&, i] { profiles[i] = probe_clip(clip_paths[i]); }));
+    }
+    // Clips that differ from the others are re-encoded first, so that the segments can be concatenated by copying.
+    const TaskGraph::TaskId profile_task = graph.add(
+        "pick the canonical clip profile",
+        [&] {
+          canonical = canonical_clip_profile(profiles);
+          const std::size_t mismatched_count =
+              clip_count - static_cast<std::size_t>(std::count(profiles.begin(), profiles.end(), canonical));
+          if (mismatched_count != 0) {
+            print_line("Normalizing ", mismatched_count, " of ", clip_count, " clips to ", canonical.to_string(), ".");
+            create_dir(normalized_folder);
+          }
+        },
+        probe_tasks);
 
-  if (edit_latex)
-    wait_on_enter();
+    const JobSchedule schedule = schedule_jobs(clip_count, jobs, ffmpeg_threads);
+    std::atomic<std::size_t> overlaid_count{0};
+    std::vector<TaskGraph::TaskId> segment_tasks;
+    for (std::size_t i = 0; i < clip_count; i++) {
+      const std::size_t state = visited_states[i];
+      const std::string &name = std::to_string(state);
+      const TaskGraph::TaskId normalize_task = graph.add(
+          "normalize " + clip_paths[i].filename().string(),
+          [&, i] {
+            if (profiles[i] == canonical) {
+              return;
+            }
+            const fs::path &output_file_path = normalized_folder / clip_paths[i].filename();
+            const bool cached = normalize_clip(clip_paths[i], profiles[i], canonical, output_file_path,
+                                               file_extension, verbose, cache);
+            print_line(cached ? "Used cached " : "Normalized ", clip_paths[i], " (", profiles[i].to_string(), ").");
+            clip_paths[i] = output_file_path;
+          },
+          {profile_task});
 
-  compile_all_markov_graphs(build_folder, transition_matrix_size, latex_output_directory, latex_compiler,
-                            latex_compiler_options, verbose);
-  convert_all_pdfs_to_pngs(build_folder / latex_output_directory, transition_matrix_size, build_folder, verbose);
-  overlay_images_to_videos(video_folder, file_extension, build_folder, transition_matrix_size, build_folder, verbose);
-  create_filelist(markov_states, build_folder / filelist_path, overlay_extension, file_extension);
-  combine_segments(build_folder / filelist_path, output_path, verbose);
+      // A segment waits for its clip and its graph only, so it is overlaid while other graphs are still drawn.
+      std::vector<TaskGraph::TaskId> overlay_dependencies = graph_tasks[i];
+      overlay_dependencies.push_back(normalize_task);
+      const fs::path &output_file_path =
+          name + std::string(constants::DEFAULT_VIDEO_OVERLAY_NAME) + "." + file_extension;
+      const TaskGraph::TaskId overlay_task = graph.add(
+          "overlay " + output_file_path.string(),
+          [&, i, name, output_file_path] {
+            const bool cached = overlay_segment(clip_paths[i], build_folder / (name + ".png"),
+                                                build_folder / output_file_path, file_extension, verbose, cache,
+                                                schedule.threads_per_job);
+            print_line("[", ++overlaid_count, "/", clip_count, "] ", cached ? "Used cached " : "Overlaid ",
+                       output_file_path, ".");
+          },
+          overlay_dependencies);
+      segment_tasks.push_back(overlay_task);
+
+      for (unsigned bit = 1; bit < 64; bit++) {
+        const std::uint64_t repeat_count = std::uint64_t{1} << bit;
+        if (state < repeat_masks.size() && (repeat_masks[state] & repeat_count)) {
+          segment_tasks.push_back(graph.add(
+              "repeat " + output_file_path.string() + " " + std::to_string(repeat_count) + " times",
+              [&, state, repeat_count, output_file_path] {
+                print_line("Repeating ", output_file_path, " ", repeat_count, " times.");
+                create_repeated_segment(build_folder, state, repeat_count, overlay_extension, file_extension,
+                                        verbose);
+              },
+              {overlay_task}));
+        }
+      }
+    }
+    graph.add(
+        "combine the segments",
+        [&] { combine_segments(build_folder / filelist_path, output_path, verbose); },
+        segment_tasks);
+
+    std::cout << "Overlaying " << clip_count << " segments with " << schedule.threads_per_job
+              << " ffmpeg threads each." << std::endl;
+    // A fixed number of ffmpeg threads lowers how many tasks run at once, so that the overlays fit the cores.
+    graph.run(ffmpeg_threads == 0 ? jobs : schedule.jobs);
+  }
 
   if (!no_cleanup)
     delete_dir_or_file(build_folder);
 }
 
 void MarkovProcessor::gif(std::size_t iterations) const {
-  const std::size_t &transition_matrix_size = mc.get_transition_matrix_size();
-  const auto &markov_states = iterate_markov_states(mc, iterations);
+  const MarkovTrajectory markov_states = mc.trajectory(iterations);
+  const std::vector<std::size_t> visited_states = markov_states.visited_states();
 
   create_dir(build_folder);
-  generate_all_markov_graphs(mc, build_folder);
-
-  if (edit_latex)
-    wait_on_enter();
+  TaskGraph graph;
+  const std::vector<std::vector<TaskGraph::TaskId>> graph_tasks = add_graph_tasks(graph, visited_states, build_folder);
 
-  compile_all_markov_graphs(build_folder, transition_matrix_size, latex_output_directory, latex_compiler,
-                            latex_compiler_options, verbose);
-  convert_all_pdfs_to_pngs(build_folder / latex_output_directory, transition_matrix_size, build_folder, verbose);
-  create_filelist(markov_states, build_folder / filelist_path, "", "png");
-  create_gif(build_folder / filelist_path, output_path, verbose);
+  // The graphs are quantized once with a palette shared by every frame, so the GIF encoder only copies indexed frames.
+  const fs::path &palette_path = build_folder / constants::DEFAULT_GIF_PALETTE_NAME;
+  const TaskGraph::TaskId palette_task = graph.add(
+      "generate the GIF palette",
+      [&] { generate_gif_palette(build_folder, visited_states, palette_path, gif_options, verbose, cache); },
+      flatten(graph_tasks));
+  std::vector<TaskGraph::TaskId> frame_tasks;
+  for (std::size_t state : visited_states) {
+    const fs::path &image_path = build_folder / (std::to_string(state) + ".png");
+    frame_tasks.push_back(graph.add(
+        "quantize " + image_path.filename().string(),
+        [&, state, image_path] {
+          if (!quantize_gif_frame(build_folder, state, palette_path, gif_options, verbose, cache))
+            print_line("Quantized ", image_path, ".");
+        },
+        {palette_task}));
+  }
+  create_image_filelist(markov_states, build_folder / filelist_path, std::string(constants::DEFAULT_GIF_FRAME_NAME));
+  graph.add(
+      "create the GIF",
+      [&] { create_gif(build_folder / filelist_path, output_path, gif_options, verbose); },
+      frame_tasks);
+  graph.run(jobs);
 
   if (!no_cleanup)
     delete_dir_or_file(build_folder);
 }
 
 void MarkovProcessor::build_only() const {
-  const std::size_t &transition_matrix_size = mc.get_transition_matrix_size();
-
   create_dir(build_folder);
   create_dir(output_path);
-  generate_all_markov_graphs(mc, build_folder);
 
-  if (edit_latex)
-    wait_on_enter();
-
-  compile_all_markov_graphs(build_folder, transition_matrix_size, latex_output_directory, latex_compiler,
-                            latex_compiler_options, verbose);
-  convert_all_pdfs_to_pngs(build_folder / latex_output_directory, transition_matrix_size, output_path, verbose);
+  std::vector<std::size_t> states(mc.get_transition_matrix_size());
+  std::iota(states.begin(), states.end(), std::size_t{0});
+  TaskGraph graph;
+  add_graph_tasks(graph, states, output_path);
+  graph.run(jobs);
 
   if (!no_cleanup)
     delete_dir_or_file(build_folder);
 }
 
-void MarkovProcessor::no_options() const {
-  const std::size_t &transition_matrix_size = mc.get_transition_matrix_size();
+void MarkovProcessor::no_options() const { build_only(); }
 
-  create_dir(build_folder);
-  create_dir(output_path);
-  generate_all_markov_graphs(mc, build_folder);
+std::vector<std::vector<TaskGraph::TaskId>>
+MarkovProcessor::add_graph_tasks(TaskGraph &graph, const std::vector<std::size_t> &states,
+                                 const fs::path &png_output_path) const {
+  std::vector<std::vector<TaskGraph::TaskId>> ready_tasks(states.size());
 
-  if (edit_latex)
-    wait_on_enter();
+  // Edited latex files are not part of the key, so their graphs are never cached.
+  const bool use_cache = cache != nullptr && !(edit_latex && renderer == GraphRenderer::Latex);
+  const CacheKey key = graph_key();
+  auto state_key = [key](std::size_t state) { return CacheKey(key).add(static_cast<std::uint64_t>(state)); };
+  auto png_path = [png_output_path](std::size_t state) { return png_output_path / (std::to_string(state) + ".png"); };
 
-  compile_all_markov_graphs(build_folder, transition_matrix_size, latex_output_directory, latex_compiler,
-                            latex_compiler_options, verbose);
-  convert_all_pdfs_to_pngs(build_folder / latex_output_directory, transition_matrix_size, output_path, verbose);
+  std::vector<std::size_t> missing;
+  for (std::size_t i = 0; i < states.size(); i++) {
+    if (!use_cache || !cache->fetch(state_key(states[i]), "png", png_path(states[i])))
+      missing.push_back(i);
+  }
+  if (use_cache && missing.size() != states.size())
+    std::cout << "Using " << states.size() - missing.size() << " cached markov graphs." << std::endl;
+  if (missing.empty()) {
+    return ready_tasks;
+  }
 
-  if (!no_cleanup)
-    delete_dir_or_file(build_folder);
+  auto store = [this, use_cache, state_key, png_path](std::size_t state) {
+    if (use_cache)
+      cache->store(state_key(state), "png", png_path(state));
+  };
+  const std::shared_ptr<GraphResources> resources = std::make_shared<GraphResources>();
+  const TaskGraph::TaskId layout_task = graph.add("compute the graph layout", [this, resources] {
+    // Every highlighted variant shares the layout, so it is only computed once.
+    resources->layout = std::make_unique<const GraphLayout>(compute_graph_layout(mc, layout_options));
+    if (renderer == GraphRenderer::Native)
+      resources->renderer = std::make_unique<const NativeGraphRenderer>(mc, *resources->layout);
+    else if (!single_document)
+      resources->picture = std::make_unique<const MarkovGraphPicture>(mc, *resources->layout);
+  });
+
+  if (renderer == GraphRenderer::Native) {
+    for (std::size_t i : missing) {
+      const std::size_t state = states[i];
+      ready_tasks[i].push_back(graph.add(
+          "render " + png_path(state).filename().string(),
+          [resources, state, png_path, store] {
+            print_line("Rendering markov graph ", png_path(state).filename(), ".");
+            resources->renderer->render(state, png_path(state));
+            store(state);
+          },
+          {layout_task}));
+    }
+    return ready_tasks;
+  }
+
+  const fs::path &pdf_folder = build_folder / latex_output_directory;
+  create_dir(pdf_folder);
+  auto wait_for_edits = [&](const std::vector<TaskGraph::TaskId> &write_tasks) {
+    return graph.add("wait for the edited latex files", [] { wait_on_enter(); }, write_tasks);
+  };
+
+  if (single_document) {
+    const std::string document_name(constants::DEFAULT_LATEX_DOCUMENT_NAME);
+    const fs::path &document_path = build_folder / (document_name + ".tex");
+    TaskGraph::TaskId document_task = graph.add(
+        "write " + document_path.filename().string(),
+        [resources, this, document_path] { generate_markov_graph_document(mc, *resources->layout, document_path); },
+        {layout_task});
+    if (edit_latex)
+      document_task = wait_for_edits({document_task});
+    const TaskGraph::TaskId compile_task = graph.add(
+        "compile " + document_path.filename().string(),
+        [this, document_name] {
+          print_line("Compiling ", fs::path(document_name + ".tex"));
+          compile_markov_graph(build_folder, document_name + ".tex", latex_output_directory, latex_compiler,
+                               latex_compiler_options, verbose);
+        },
+        {document_task});
+    const fs::path &pdf_path = pdf_folder / (document_name + ".pdf");
+    for (std::size_t i : missing) {
+      const std::size_t state = states[i];
+      ready_tasks[i].push_back(graph.add(
+          "rasterize page " + std::to_string(state) + " of " + pdf_path.filename().string(),
+          [this, state, pdf_path, png_path, store] {
+            print_line("Converting page ", state, " of ", pdf_path, " to ", png_path(state).filename(), ".");
+            convert_pdf_to_png(pdf_path, png_path(state), raster_options, verbose, state);
+            store(state);
+          },
+          {compile_task}));
+    }
+    return ready_tasks;
+  }
+
+  std::vector<TaskGraph::TaskId> write_tasks;
+  for (std::size_t i : missing) {
+    const std::size_t state = states[i];
+    const fs::path &tex_path = build_folder / (std::to_string(state) + ".tex");
+    write_tasks.push_back(graph.add(
+        "write " + tex_path.filename().string(),
+        [resources, state, tex_path] {
+          print_line("Generating markov graph ", tex_path.filename(), ".");
+          resources->picture->write_document(tex_path, state);
+        },
+        {layout_task}));
+  }
+  // Every file has to be written before the user edits them, otherwise a file only waits for its own.
+  const std::optional<TaskGraph::TaskId> edit_task =
+      edit_latex ? std::optional<TaskGraph::TaskId>(wait_for_edits(write_tasks)) : std::nullopt;
+  for (std::size_t j = 0; j < missing.size(); j++) {
+    const std::size_t i = missing[j];
+    const std::size_t state = states[i];
+    const std::string &name = std::to_string(state);
+    const TaskGraph::TaskId compile_task = graph.add(
+        "compile " + name + ".tex",
+        [this, state, name] {
+          print_line("Compiling ", fs::path(name + ".tex"));
+          compile_markov_graph_isolated(build_folder, state, latex_output_directory, latex_compiler,
+                                        latex_compiler_options, verbose);
+        },
+        {edit_task ? *edit_task : write_tasks[j]});
+    ready_tasks[i].push_back(graph.add(
+        "rasterize " + name + ".pdf",
+        [this, state, name, pdf_folder, png_path, store] {
+          print_line("Converting ", fs::path(name + ".pdf"), " to ", png_path(state).filename(), ".");
+          convert_pdf_to_png(pdf_folder / (name + ".pdf"), png_path(state), raster_options, verbose);
+          store(state);
+        },
+        {compile_task}));
+  }
+  return ready_tasks;
+}
+
+CacheKey MarkovProcessor::graph_key() const {
+  CacheKey key;
+  key.add("graph")
+      .add_model(mc)
+      .add(constants::DEFAULT_HIGHLIGHT_COLOR)
+      .add(static_cast<std::uint64_t>(layout_options.algorithm))
+      .add(layout_options.prune_threshold)
+      .add(static_cast<std::uint64_t>(layout_options.bundle_edges));
+  if (renderer == GraphRenderer::Native) {
+    key.add("native");
+  } else {
+    key.add("latex")
+        .add(latex_compiler)
+        .add(latex_compiler_options)
+        .add(constants::DEFAULT_LATEX_PREAMBLE)
+        .add(constants::DEFAULT_LATEX_PICTURE_BEGIN)
+        .add(raster_options.dpi)
+        .add(static_cast<std::uint64_t>(raster_options.width));
+  }
+  return key;
 }
 
 ProcessingMode determine_processing_mode(bool video_used, bool gif_used) {
@@ -104,3 +398,21 @@ ProcessingMode determine_processing_mode(bool video_used, bool gif_used) {
   else
     return ProcessingMode::BuildOnly;
 }
+
+GraphRenderer graph_renderer_from_string(const std::string &name) {
+  if (name == "latex")
+    return GraphRenderer::Latex;
+  else if (name == "native")
+    return GraphRenderer::Native;
+  else
+    throw std::invalid_argument("Unknown graph renderer: " + name);
+}
+
+VideoBackend video_backend_from_string(const std::string &name) {
+  if (name == "cli")
+    return VideoBackend::Cli;
+  else if (name == "libav")
+    return VideoBackend::Libav;
+  else
+    throw std::invalid_argument("Unknown video backend: " + name);
+}
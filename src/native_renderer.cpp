@@ -0,0 +1,349 @@
+// Source code of the native graph renderer, which draws the Markov Graphs without LaTeX.
+//
+// EVA License
+
+#include "native_renderer.hpp"
+#include "canvas.hpp"
+#include "graph_layout.hpp"
+#include "markov.hpp"
+#include "png.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+// The scene is drawn in centimeters with the y axis pointing up, like TikZ, and scaled to pixels when drawing.
+constexpr double PIXELS_PER_CM = 100.0;
+constexpr double PI = 3.14159265358979323846;
+
+// Layout positions are scaled like the tikzpicture of write_markov_graph, while the nodes stay 1cm wide.
+constexpr double PICTURE_SCALE = 2.0;
+constexpr double NODE_RADIUS = 0.5;
+// Default TikZ values for bend left/right, loop above, inner sep and the standalone border.
+constexpr double BEND_ANGLE = 30.0 * PI / 180.0;
+constexpr double LOOP_OUT_ANGLE = 105.0 * PI / 180.0;
+constexpr double LOOP_IN_ANGLE = 75.0 * PI / 180.0;
+constexpr double LOOP_LOOSENESS = 8.0;
+constexpr double LOOP_MIN_DISTANCE = 0.5;
+constexpr double CONTROL_FACTOR = 0.3915;
+constexpr double LABEL_SEPARATION = 0.1;
+constexpr double BORDER = 0.35;
+
+constexpr double LINE_WIDTH = 1.5;
+constexpr double ARROW_LENGTH = 0.15;
+constexpr double ARROW_HALF_WIDTH = 0.07;
+constexpr std::size_t CURVE_SEGMENTS = 24;
+constexpr std::size_t TEXT_SCALE = 3;
+
+constexpr Color BLACK = {0, 0, 0};
+constexpr Color WHITE = {255, 255, 255};
+
+struct NamedColor {
+  const char *name;
+  Color color;
+};
+
+// The colors xcolor defines without options.
+constexpr NamedColor NAMED_COLORS[] = {
+    {"black", {0, 0, 0}},         {"blue", {0, 0, 255}},         {"brown", {191, 128, 64}},
+    {"cyan", {0, 255, 255}},      {"darkgray", {64, 64, 64}},    {"gray", {128, 128, 128}},
+    {"green", {0, 255, 0}},       {"lightgray", {191, 191, 191}}, {"lime", {191, 255, 0}},
+    {"magenta", {255, 0, 255}},   {"olive", {128, 128, 0}},      {"orange", {255, 128, 0}},
+    {"pink", {255, 191, 191}},    {"purple", {191, 0, 64}},      {"red", {255, 0, 0}},
+    {"teal", {0, 128, 128}},      {"violet", {128, 0, 128}},     {"white", {255, 255, 255}},
+    {"yellow", {255, 255, 0}},
+};
+
+struct Label {
+  // Center of the text in centimeters.
+  Point center;
+  std::string text;
+};
+
+struct Scene {
+  std::vector<Point> nodes;
+  std::vector<std::string> names;
+  // Edges as polylines ending at the base of their arrow tip.
+  std::vector<std::vector<Point>> edges;
+  std::vector<std::array<Point, 3>> arrow_tips;
+  std::vector<Label> labels;
+  double min_x, min_y, max_x, max_y;
+};
+
+Point direction(double angle) { return {std::cos(angle), std::sin(angle)}; }
+
+Point offset(Point p, Point d, double distance) { return {p.x + d.x * distance, p.y + d.y * distance}; }
+
+Point cubic_bezier(const std::array<Point, 4> &c, double t) {
+  const double s = 1.0 - t;
+  const double a = s * s * s, b = 3 * s * s * t, d = 3 * s * t * t, e = t * t * t;
+  return {a * c[0].x + b * c[1].x + d * c[2].x + e * c[3].x, a * c[0].y + b * c[1].y + d * c[2].y + e * c[3].y};
+}
+
+double text_width_cm(const std::string &text) { return Canvas::text_width(text, TEXT_SCALE) / PIXELS_PER_CM; }
+
+double text_height_cm() { return Canvas::text_height(TEXT_SCALE) / PIXELS_PER_CM; }
+
+std::string format_probability(double probability) {
+  std::ostringstream label;
+  label << std::fixed << std::setprecision(2) << probability;
+  return label.str();
+}
+
+// Adds the cubic curve from start to end with its arrow tip and its label, which sits above, below or on the left of
+// the curve's midpoint.
+void add_curve(Scene &scene, const std::array<Point, 4> &control_points, LabelPlacement placement,
+               const std::string &text) {
+  std::array<Point, 4> curve = control_points;
+  const Point end = curve[3];
+
+  // The arrow points along the tangent at the end, and the curve stops at its base so the line does not show through.
+  const double tangent_length = std::hypot(end.x - curve[2].x, end.y - curve[2].y);
+  const Point tangent = {(end.x - curve[2].x) / tangent_length, (end.y - curve[2].y) / tangent_length};
+  const Point base = offset(end, tangent, -ARROW_LENGTH);
+  const Point normal = {-tangent.y, tangent.x};
+  scene.arrow_tips.push_back({end, offset(base, normal, ARROW_HALF_WIDTH), offset(base, normal, -ARROW_HALF_WIDTH)});
+  const Point middle = cubic_bezier(curve, 0.5);
+  curve[3] = base;
+
+  std::vector<Point> points;
+  points.reserve(CURVE_SEGMENTS + 1);
+  for (std::size_t k = 0; k <= CURVE_SEGMENTS; k++) {
+    points.push_back(cubic_bezier(curve, static_cast<double>(k) / CURVE_SEGMENTS));
+  }
+  scene.edges.push_back(std::move(points));
+
+  const double half_width = text_width_cm(text) / 2;
+  const double half_height = text_height_cm() / 2;
+  switch (placement) {
+  case LabelPlacement::Above:
+    scene.labels.push_back({{middle.x, middle.y + LABEL_SEPARATION + half_height}, text});
+    break;
+  case LabelPlacement::Below:
+    scene.labels.push_back({{middle.x, middle.y - LABEL_SEPARATION - half_height}, text});
+    break;
+  case LabelPlacement::Auto: {
+    // Left of the chord, far enough that the label's box clears the curve.
+    const double chord_length = std::hypot(end.x - curve[0].x, end.y - curve[0].y);
+    const Point left = {-(end.y - curve[0].y) / chord_length, (end.x - curve[0].x) / chord_length};
+    const double reach = LABEL_SEPARATION + std::abs(left.x) * half_width + std::abs(left.y) * half_height;
+    scene.labels.push_back({offset(middle, left, reach), text});
+    break;
+  }
+  case LabelPlacement::None:
+    break;
+  }
+}
+
+// Adds the edge leaving from at out_angle and entering to at in_angle, with TikZ's control point distance.
+void add_edge(Scene &scene, Point from, Point to, double out_angle, double in_angle, double looseness,
+              double min_distance, LabelPlacement placement, const std::string &text) {
+  const Point out_direction = direction(out_angle);
+  const Point in_direction = direction(in_angle);
+  const Point start = offset(from, out_direction, NODE_RADIUS);
+  const Point end = offset(to, in_direction, NODE_RADIUS);
+  const double control_distance =
+      std::max(min_distance, looseness * CONTROL_FACTOR * std::hypot(end.x - start.x, end.y - start.y));
+  add_curve(scene,
+            {start, offset(start, out_direction, control_distance), offset(end, in_direction, control_distance), end},
+            placement, text);
+}
+
+Point scaled(Point p) { return {p.x * PICTURE_SCALE, p.y * PICTURE_SCALE}; }
+
+Scene build_scene(const MarkovModel &mc, const GraphLayout &layout) {
+  Scene scene;
+  for (std::size_t i = 0; i < layout.positions.size(); ++i) {
+    scene.nodes.push_back(scaled(layout.positions[i]));
+    scene.names.push_back(mc.get_state_name(i));
+  }
+
+  for (const LayoutEdge &edge : layout.edges) {
+    const std::string text = format_probability(edge.probability);
+    const Point from = scene.nodes[edge.from];
+    const Point to = scene.nodes[edge.to];
+    const double angle = std::atan2(to.y - from.y, to.x - from.x);
+    switch (edge.shape) {
+    case EdgeShape::Loop:
+      add_edge(scene, from, to, LOOP_OUT_ANGLE, LOOP_IN_ANGLE, LOOP_LOOSENESS, LOOP_MIN_DISTANCE, edge.label, text);
+      break;
+    case EdgeShape::Left:
+      add_edge(scene, from, to, angle + BEND_ANGLE, angle + PI - BEND_ANGLE, 1.0, 0.0, edge.label, text);
+      break;
+    case EdgeShape::Right:
+      add_edge(scene, from, to, angle - BEND_ANGLE, angle + PI + BEND_ANGLE, 1.0, 0.0, edge.label, text);
+      break;
+    case EdgeShape::Straight:
+      add_edge(scene, from, to, angle, angle + PI, 1.0, 0.0, edge.label, text);
+      break;
+    case EdgeShape::Bundled: {
+      // Like TikZ, the curve leaves and enters the nodes towards the neighboring control points.
+      const Point control_from = scaled(edge.control_from);
+      const Point control_to = scaled(edge.control_to);
+      const Point start =
+          offset(from, direction(std::atan2(control_from.y - from.y, control_from.x - from.x)), NODE_RADIUS);
+      const Point end = offset(to, direction(std::atan2(control_to.y - to.y, control_to.x - to.x)), NODE_RADIUS);
+      add_curve(scene, {start, control_from, control_to, end}, edge.label, text);
+      break;
+    }
+    }
+  }
+
+  // The picture is cropped to everything drawn, plus the border of the standalone class.
+  scene.min_x = scene.min_y = 1e300;
+  scene.max_x = scene.max_y = -1e300;
+  auto include = [&scene](Point p, double half_width, double half_height) {
+    scene.min_x = std::min(scene.min_x, p.x - half_width);
+    scene.max_x = std::max(scene.max_x, p.x + half_width);
+    scene.min_y = std::min(scene.min_y, p.y - half_height);
+    scene.max_y = std::max(scene.max_y, p.y + half_height);
+  };
+  for (const Point &node : scene.nodes) {
+    include(node, NODE_RADIUS, NODE_RADIUS);
+  }
+  for (const std::vector<Point> &edge : scene.edges) {
+    for (const Point &point : edge) {
+      include(point, 0.0, 0.0);
+    }
+  }
+  for (const std::array<Point, 3> &tip : scene.arrow_tips) {
+    for (const Point &point : tip) {
+      include(point, 0.0, 0.0);
+    }
+  }
+  for (const Label &label : scene.labels) {
+    include(label.center, text_width_cm(label.text) / 2, text_height_cm() / 2);
+  }
+  scene.min_x -= BORDER;
+  scene.min_y -= BORDER;
+  scene.max_x += BORDER;
+  scene.max_y += BORDER;
+  return scene;
+}
+
+Point to_pixels(const Scene &scene, Point p) {
+  return {(p.x - scene.min_x) * PIXELS_PER_CM, (scene.max_y - p.y) * PIXELS_PER_CM};
+}
+
+// Draws the scene onto canvas, which shows the part of the full picture whose top left pixel is origin. Drawing a
+// part gives exactly the pixels the full picture has there.
+void draw_scene(Canvas &canvas, const Scene &scene, Point origin, std::size_t highlight_index, Color highlight_color) {
+  auto pixel = [&](Point p) {
+    const Point full = to_pixels(scene, p);
+    return Point{full.x - origin.x, full.y - origin.y};
+  };
+  // Draws text centered on center, which is given in centimeters.
+  auto draw_centered_text = [&](Point center, const std::string &text) {
+    const Point middle = pixel(center);
+    canvas.draw_text({middle.x - Canvas::text_width(text, TEXT_SCALE) / 2.0,
+                      middle.y - Canvas::text_height(TEXT_SCALE) / 2.0},
+                     text, TEXT_SCALE, BLACK);
+  };
+
+  for (const std::vector<Point> &edge : scene.edges) {
+    std::vector<Point> pixels;
+    pixels.reserve(edge.size());
+    for (const Point &point : edge) {
+      pixels.push_back(pixel(point));
+    }
+    canvas.stroke_polyline(pixels, LINE_WIDTH, BLACK);
+  }
+  for (const std::array<Point, 3> &tip : scene.arrow_tips) {
+    canvas.fill_convex_polygon({pixel(tip[0]), pixel(tip[1]), pixel(tip[2])}, BLACK);
+  }
+  for (const Label &label : scene.labels) {
+    draw_centered_text(label.center, label.text);
+  }
+
+  for (std::size_t i = 0; i < scene.nodes.size(); i++) {
+    const Point center = pixel(scene.nodes[i]);
+    const double radius = NODE_RADIUS * PIXELS_PER_CM;
+    canvas.fill_circle(center, radius, i == highlight_index ? highlight_color : WHITE);
+    canvas.stroke_circle(center, radius, LINE_WIDTH, BLACK);
+    draw_centered_text(scene.nodes[i], scene.names[i]);
+  }
+}
+
+std::size_t canvas_width(const Scene &scene) {
+  return static_cast<std::size_t>(std::ceil((scene.max_x - scene.min_x) * PIXELS_PER_CM));
+}
+
+std::size_t canvas_height(const Scene &scene) {
+  return static_cast<std::size_t>(std::ceil((scene.max_y - scene.min_y) * PIXELS_PER_CM));
+}
+
+Canvas draw_markov_graph(const Scene &scene, std::size_t highlight_index, Color highlight_color) {
+  Canvas canvas(canvas_width(scene), canvas_height(scene), WHITE);
+  draw_scene(canvas, scene, {0.0, 0.0}, highlight_index, highlight_color);
+  return canvas;
+}
+
+// Draws the graph with node highlight_index filled by drawing only the pixels around that node onto a copy of base,
+// the graph without any highlighted node.
+Canvas composite_markov_graph(const Canvas &base, const Scene &scene, std::size_t highlight_index,
+                              Color highlight_color) {
+  const Point center = to_pixels(scene, scene.nodes[highlight_index]);
+  const double reach = NODE_RADIUS * PIXELS_PER_CM + LINE_WIDTH / 2 + 1;
+  const double x0 = std::max(0.0, std::floor(center.x - reach));
+  const double y0 = std::max(0.0, std::floor(center.y - reach));
+  const double x1 = std::min(static_cast<double>(base.width()), std::ceil(center.x + reach));
+  const double y1 = std::min(static_cast<double>(base.height()), std::ceil(center.y + reach));
+
+  Canvas sprite(static_cast<std::size_t>(x1 - x0), static_cast<std::size_t>(y1 - y0), WHITE);
+  draw_scene(sprite, scene, {x0, y0}, highlight_index, highlight_color);
+  Canvas canvas = base;
+  canvas.blit(sprite, static_cast<std::size_t>(x0), static_cast<std::size_t>(y0));
+  return canvas;
+}
+} // namespace
+
+Color color_from_name(const std::string &name) {
+  if (name.size() == 7 && name[0] == '#') {
+    std::uint32_t value = 0;
+    const auto [end, error] = std::from_chars(name.data() + 1, name.data() + name.size(), value, 16);
+    if (error == std::errc() && end == name.data() + name.size()) {
+      return {static_cast<std::uint8_t>(value >> 16), static_cast<std::uint8_t>(value >> 8),
+              static_cast<std::uint8_t>(value)};
+    }
+  }
+  for (const NamedColor &named_color : NAMED_COLORS) {
+    if (name == named_color.name) {
+      return named_color.color;
+    }
+  }
+  throw std::invalid_argument("Unknown color: " + name);
+}
+
+struct NativeGraphRenderer::Graph {
+  Scene scene;
+  Color color;
+  Canvas base;
+};
+
+NativeGraphRenderer::NativeGraphRenderer(const MarkovModel &mc, const GraphLayout &layout,
+                                         const std::string &highlight_color) {
+  Scene scene = build_scene(mc, layout);
+  const Color color = color_from_name(highlight_color);
+  // Only one node changes between the graphs, so the graph is drawn once and every state redraws its own node.
+  Canvas base = draw_markov_graph(scene, scene.nodes.size(), color);
+  graph = std::make_unique<const Graph>(Graph{std::move(scene), color, std::move(base)});
+}
+
+NativeGraphRenderer::~NativeGraphRenderer() = default;
+
+void NativeGraphRenderer::render(std::size_t highlight_index, const fs::path &png_path) const {
+  write_png(composite_markov_graph(graph->base, graph->scene, highlight_index, graph->color), png_path);
+}
@@ -0,0 +1,39 @@
+#include "philox.hpp"
+#include <cstdint>
+
+namespace {
+constexpr std::uint32_t PHILOX_M0 = 0xD2511F53;
+constexpr std::uint32_t PHILOX_M1 = 0xCD9E8D57;
+constexpr std::uint32_t PHILOX_W0 = 0x9E3779B9;
+constexpr std::uint32_t PHILOX_W1 = 0xBB67AE85;
+constexpr int PHILOX_ROUNDS = 10;
+
+PhiloxCounter philox_round(const PhiloxCounter &counter, const PhiloxKey &key) {
+  const std::uint64_t product0 = static_cast<std::uint64_t>(PHILOX_M0) * counter[0];
+  const std::uint64_t product1 = static_cast<std::uint64_t>(PHILOX_M1) * counter[2];
+
+  return {static_cast<std::uint32_t>(product1 >> 32) ^ counter[1] ^ key[0], static_cast<std::uint32_t>(product1),
+          static_cast<std::uint32_t>(product0 >> 32) ^ counter[3] ^ key[1], static_cast<std::uint32_t>(product0)};
+}
+} // namespace
+
+PhiloxCounter philox4x32(PhiloxCounter counter, PhiloxKey key) {
+  for (int round = 0; round < PHILOX_ROUNDS; round++) {
+    if (round > 0) {
+      key[0] += PHILOX_W0;
+      key[1] += PHILOX_W1;
+    }
+    counter = philox_round(counter, key);
+  }
+  return counter;
+}
+
+double philox_uniform(std::uint64_t seed, std::uint64_t stream, std::uint64_t index) {
+  const PhiloxCounter counter = {static_cast<std::uint32_t>(index), static_cast<std::uint32_t>(index >> 32),
+                                 static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32)};
+  const PhiloxKey key = {static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)};
+  const PhiloxCounter random = philox4x32(counter, key);
+
+  const std::uint64_t bits = (static_cast<std::uint64_t>(random[0]) << 32) | random[1];
+  return static_cast<double>(bits >> 11) * 0x1.0p-53;
+}
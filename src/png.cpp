@@ -0,0 +1,210 @@
+// Source code of the PNG encoder used by the native renderer.
+//
+// EVA License
+
+#include "png.hpp"
+#include "canvas.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr std::size_t MAX_MATCH_LENGTH = 258;
+constexpr std::size_t MIN_MATCH_LENGTH = 3;
+constexpr std::uint32_t ADLER_MODULUS = 65521;
+
+// Base lengths and extra bit counts of the deflate length codes 257 to 285.
+constexpr std::uint16_t LENGTH_BASES[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                            31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::uint8_t LENGTH_EXTRA_BITS[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+std::array<std::uint32_t, 256> make_crc_table() {
+  std::array<std::uint32_t, 256> table{};
+  for (std::uint32_t n = 0; n < 256; n++) {
+    std::uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    table[n] = c;
+  }
+  return table;
+}
+
+std::uint32_t crc32(const std::uint8_t *data, std::size_t size, std::uint32_t crc = 0) {
+  static const std::array<std::uint32_t, 256> table = make_crc_table();
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+std::uint32_t adler32(const std::vector<std::uint8_t> &data) {
+  std::uint32_t a = 1, b = 0;
+  for (std::uint8_t byte : data) {
+    a = (a + byte) % ADLER_MODULUS;
+    b = (b + a) % ADLER_MODULUS;
+  }
+  return (b << 16) | a;
+}
+
+// Writes the LSB first bit stream of a deflate block.
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<std::uint8_t> &output) : output(output) {}
+
+  void write_bits(std::uint32_t bits, int count) {
+    for (int k = 0; k < count; k++) {
+      push_bit((bits >> k) & 1);
+    }
+  }
+
+  // Huffman codes are stored most significant bit first.
+  void write_code(std::uint32_t code, int length) {
+    for (int k = length - 1; k >= 0; k--) {
+      push_bit((code >> k) & 1);
+    }
+  }
+
+  void flush() {
+    if (bit_count != 0) {
+      output.push_back(current);
+      current = 0;
+      bit_count = 0;
+    }
+  }
+
+private:
+  std::vector<std::uint8_t> &output;
+  std::uint8_t current = 0;
+  int bit_count = 0;
+
+  void push_bit(std::uint32_t bit) {
+    current |= static_cast<std::uint8_t>(bit << bit_count);
+    if (++bit_count == 8) {
+      flush();
+    }
+  }
+};
+
+// Writes a literal or length symbol with the fixed Huffman code of deflate.
+void write_fixed_symbol(BitWriter &writer, std::uint32_t symbol) {
+  if (symbol < 144) {
+    writer.write_code(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    writer.write_code(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    writer.write_code(symbol - 256, 7);
+  } else {
+    writer.write_code(0xC0 + symbol - 280, 8);
+  }
+}
+
+void write_match(BitWriter &writer, std::size_t length) {
+  std::size_t code = 0;
+  while (code + 1 < 29 && LENGTH_BASES[code + 1] <= length) {
+    code++;
+  }
+  write_fixed_symbol(writer, static_cast<std::uint32_t>(257 + code));
+  writer.write_bits(static_cast<std::uint32_t>(length - LENGTH_BASES[code]), LENGTH_EXTRA_BITS[code]);
+  // Every match repeats the previous byte, which is distance code 0.
+  writer.write_code(0, 5);
+}
+
+// Compresses data into a zlib stream of a single fixed Huffman block. Only runs of the same byte are matched: the
+// rendered graphs are mostly flat background, which the Up filter turns into long runs of zeros.
+std::vector<std::uint8_t> zlib_compress(const std::vector<std::uint8_t> &data) {
+  std::vector<std::uint8_t> output = {0x78, 0x01};
+  BitWriter writer(output);
+  writer.write_bits(1, 1); // Final block
+  writer.write_bits(1, 2); // Fixed Huffman codes
+
+  std::size_t i = 0;
+  while (i < data.size()) {
+    write_fixed_symbol(writer, data[i]);
+    std::size_t run = 0;
+    while (i + 1 + run < data.size() && data[i + 1 + run] == data[i]) {
+      run++;
+    }
+    i++;
+    while (run >= MIN_MATCH_LENGTH) {
+      // A remainder of one or two bytes cannot be matched, so avoid leaving one behind.
+      std::size_t length = run;
+      if (length > MAX_MATCH_LENGTH) {
+        length = run - MAX_MATCH_LENGTH < MIN_MATCH_LENGTH ? MAX_MATCH_LENGTH - MIN_MATCH_LENGTH : MAX_MATCH_LENGTH;
+      }
+      write_match(writer, length);
+      run -= length;
+      i += length;
+    }
+  }
+  write_fixed_symbol(writer, 256);
+  writer.flush();
+
+  const std::uint32_t checksum = adler32(data);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    output.push_back(static_cast<std::uint8_t>(checksum >> shift));
+  }
+  return output;
+}
+
+void append_u32(std::vector<std::uint8_t> &output, std::uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    output.push_back(static_cast<std::uint8_t>(value >> shift));
+  }
+}
+
+void write_chunk(std::ofstream &png, const char *type, const std::vector<std::uint8_t> &data) {
+  std::vector<std::uint8_t> chunk;
+  chunk.reserve(data.size() + 12);
+  append_u32(chunk, static_cast<std::uint32_t>(data.size()));
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  append_u32(chunk, crc32(chunk.data() + 4, data.size() + 4));
+  png.write(reinterpret_cast<const char *>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+}
+} // namespace
+
+void write_png(const Canvas &canvas, const fs::path &png_path) {
+  std::ofstream png(png_path, std::ios::binary);
+  if (!png.is_open()) {
+    throw std::runtime_error("Cannot open file: " + png_path.string());
+  }
+
+  const std::size_t row_size = canvas.width() * 3;
+  const std::vector<std::uint8_t> &pixels = canvas.pixels();
+
+  // Every row uses the Up filter, except the first which has nothing above it.
+  std::vector<std::uint8_t> filtered;
+  filtered.reserve(canvas.height() * (row_size + 1));
+  for (std::size_t y = 0; y < canvas.height(); y++) {
+    const std::uint8_t *row = &pixels[y * row_size];
+    filtered.push_back(y == 0 ? 0 : 2);
+    for (std::size_t x = 0; x < row_size; x++) {
+      filtered.push_back(y == 0 ? row[x] : static_cast<std::uint8_t>(row[x] - row[x - row_size]));
+    }
+  }
+
+  std::vector<std::uint8_t> header;
+  append_u32(header, static_cast<std::uint32_t>(canvas.width()));
+  append_u32(header, static_cast<std::uint32_t>(canvas.height()));
+  header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit depth, RGB, deflate, adaptive filtering, no interlace
+
+  const std::uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  png.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+  write_chunk(png, "IHDR", header);
+  write_chunk(png, "IDAT", zlib_compress(filtered));
+  write_chunk(png, "IEND", {});
+
+  if (!png) {
+    throw std::runtime_error("Cannot write file: " + png_path.string());
+  }
+}
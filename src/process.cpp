@@ -0,0 +1,371 @@
+// Source code of the process executor that runs ffmpeg, LaTeX and ImageMagick.
+//
+// EVA License
+
+#include "process.hpp"
+#include "helpers.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <cstdio>
+#include <cstdlib>
+#else
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace {
+// How often a waiting worker checks the timeout and cancellation of its process.
+constexpr int PROCESS_POLL_MILLISECONDS = 100;
+
+// Keeps the last capacity bytes written to it.
+class RingBuffer {
+public:
+  explicit RingBuffer(std::size_t capacity) : data(capacity) {}
+
+  void append(const char *bytes, std::size_t count) {
+    if (data.empty()) {
+      return;
+    }
+    // Only the bytes that fit can survive.
+    if (count > data.size()) {
+      bytes += count - data.size();
+      count = data.size();
+    }
+    for (std::size_t i = 0; i < count; i++) {
+      data[(start + size) % data.size()] = bytes[i];
+      if (size < data.size())
+        size++;
+      else
+        start = (start + 1) % data.size();
+    }
+  }
+
+  std::string str() const {
+    std::string text;
+    text.reserve(size);
+    for (std::size_t i = 0; i < size; i++) {
+      text.push_back(data[(start + i) % data.size()]);
+    }
+    return text;
+  }
+
+private:
+  std::vector<char> data;
+  std::size_t start = 0;
+  std::size_t size = 0;
+};
+
+#ifdef _WIN32
+ProcessResult run_process(const Command &command, const ProcessOptions &options, std::chrono::milliseconds,
+                          const std::atomic<bool> &cancel_requested) {
+  ProcessResult result;
+  if (cancel_requested) {
+    result.exit_code = -1;
+    result.cancelled = true;
+    return result;
+  }
+
+  std::string command_line = format_command(command);
+  if (options.capture_output) {
+    FILE *pipe = _popen(command_line.c_str(), "r");
+    if (pipe == nullptr) {
+      throw std::runtime_error("Cannot start " + command_line);
+    }
+    char buffer[4096];
+    std::size_t read_count;
+    while ((read_count = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+      result.output.append(buffer, read_count);
+    }
+    result.exit_code = _pclose(pipe);
+    return result;
+  }
+  if (!options.verbose) {
+    command_line += " > NUL 2>&1";
+  }
+  result.exit_code = std::system(command_line.c_str());
+  return result;
+}
+#else
+void close_descriptor(int &descriptor) {
+  if (descriptor >= 0) {
+    close(descriptor);
+    descriptor = -1;
+  }
+}
+
+// Reads what is available from the descriptor, closing it at the end of the stream.
+void drain_descriptor(int &descriptor, std::string *output, RingBuffer *tail, bool echo) {
+  char buffer[4096];
+  const ssize_t read_count = read(descriptor, buffer, sizeof(buffer));
+  if (read_count < 0 && errno == EINTR) {
+    return;
+  }
+  if (read_count <= 0) {
+    close_descriptor(descriptor);
+    return;
+  }
+  const std::size_t count = static_cast<std::size_t>(read_count);
+  if (output != nullptr)
+    output->append(buffer, count);
+  if (tail != nullptr)
+    tail->append(buffer, count);
+  if (echo)
+    std::cerr.write(buffer, read_count);
+}
+
+ProcessResult run_process(const Command &command, const ProcessOptions &options, std::chrono::milliseconds timeout,
+                          const std::atomic<bool> &cancel_requested) {
+  ProcessResult result;
+  if (command.empty()) {
+    throw std::invalid_argument("Cannot run an empty command.");
+  }
+  if (cancel_requested) {
+    result.exit_code = -1;
+    result.cancelled = true;
+    return result;
+  }
+
+  std::vector<char *> arguments;
+  for (const std::string &argument : command) {
+    arguments.push_back(const_cast<char *>(argument.c_str()));
+  }
+  arguments.push_back(nullptr);
+
+  // Pipes are only close-on-exec once fcntl returns, so no other process may be spawned in between, or it would keep
+  // the write ends open and the readers would never see the end of the stream.
+  static std::mutex spawn_mutex;
+  int error_pipe[2] = {-1, -1};
+  int output_pipe[2] = {-1, -1};
+  pid_t pid = 0;
+  int spawn_error = 0;
+  {
+    std::lock_guard<std::mutex> lock(spawn_mutex);
+    if (pipe(error_pipe) != 0 || (options.capture_output && pipe(output_pipe) != 0)) {
+      spawn_error = errno;
+    }
+    for (int descriptor : {error_pipe[0], error_pipe[1], output_pipe[0], output_pipe[1]}) {
+      if (descriptor >= 0)
+        fcntl(descriptor, F_SETFD, FD_CLOEXEC);
+    }
+
+    if (spawn_error == 0) {
+      posix_spawn_file_actions_t actions;
+      posix_spawn_file_actions_init(&actions);
+      posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+      if (options.capture_output)
+        posix_spawn_file_actions_adddup2(&actions, output_pipe[1], STDOUT_FILENO);
+      else if (!options.verbose)
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+      posix_spawn_file_actions_adddup2(&actions, error_pipe[1], STDERR_FILENO);
+      // Every process leads a group of its own, so that a timeout or cancellation also stops the processes it started.
+      posix_spawnattr_t attributes;
+      posix_spawnattr_init(&attributes);
+      posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+      posix_spawnattr_setpgroup(&attributes, 0);
+      spawn_error = posix_spawnp(&pid, arguments[0], &actions, &attributes, arguments.data(), environ);
+      posix_spawnattr_destroy(&attributes);
+      posix_spawn_file_actions_destroy(&actions);
+    }
+  }
+  close_descriptor(error_pipe[1]);
+  close_descriptor(output_pipe[1]);
+  if (spawn_error != 0) {
+    close_descriptor(error_pipe[0]);
+    close_descriptor(output_pipe[0]);
+    throw std::runtime_error("Cannot start " + format_command(command) + ": " + std::strerror(spawn_error));
+  }
+
+  RingBuffer error_tail(constants::DEFAULT_ERROR_TAIL_BYTES);
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  bool killed = false;
+  bool exited = false;
+  int status = 0;
+  while (!exited) {
+    if (error_pipe[0] >= 0 || output_pipe[0] >= 0) {
+      pollfd descriptors[2] = {{error_pipe[0], POLLIN, 0}, {output_pipe[0], POLLIN, 0}};
+      if (poll(descriptors, 2, PROCESS_POLL_MILLISECONDS) > 0) {
+        if (descriptors[0].revents != 0)
+          drain_descriptor(error_pipe[0], nullptr, &error_tail, options.verbose);
+        if (descriptors[1].revents != 0)
+          drain_descriptor(output_pipe[0], &result.output, nullptr, false);
+      }
+    } else {
+      // The process closed its output, so only its exit is left to wait for.
+      const pid_t waited = waitpid(pid, &status, WNOHANG);
+      if (waited < 0 && errno != EINTR) {
+        break;
+      }
+      exited = waited == pid;
+      if (!exited)
+        poll(nullptr, 0, PROCESS_POLL_MILLISECONDS);
+    }
+
+    if (!killed) {
+      result.cancelled = cancel_requested;
+      result.timed_out = timeout.count() != 0 && std::chrono::steady_clock::now() >= deadline;
+      if (result.cancelled || result.timed_out) {
+        kill(-pid, SIGKILL);
+        killed = true;
+        // Children of the process may still hold the pipes open, so only its exit is waited for.
+        close_descriptor(error_pipe[0]);
+        close_descriptor(output_pipe[0]);
+      }
+    }
+  }
+  close_descriptor(error_pipe[0]);
+  close_descriptor(output_pipe[0]);
+
+  result.exit_code = exited && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  result.error_tail = error_tail.str();
+  return result;
+}
+#endif
+} // namespace
+
+ProcessExecutor::ProcessExecutor(std::size_t max_processes)
+    : max_processes(max_processes == 0 ? hardware_threads() : max_processes) {}
+
+ProcessExecutor::~ProcessExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queue_changed.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+ProcessExecutor &ProcessExecutor::global() {
+  static ProcessExecutor executor;
+  return executor;
+}
+
+std::future<ProcessResult> ProcessExecutor::submit(Command command, const ProcessOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex);
+  queue.push_back({std::move(command), options, {}});
+  std::future<ProcessResult> result = queue.back().promise.get_future();
+  // Workers are started as they are needed, up to the process limit. Idle workers may not have taken the commands
+  // queued before this one yet, so they only count for the commands left over.
+  if (idle_count < queue.size() && workers.size() < max_processes) {
+    workers.emplace_back(&ProcessExecutor::work, this);
+  }
+  queue_changed.notify_one();
+  return result;
+}
+
+ProcessResult ProcessExecutor::run(const Command &command, const ProcessOptions &options) {
+  ProcessResult result = submit(command, options).get();
+  if (result.succeeded()) {
+    return result;
+  }
+
+  std::string message;
+  if (result.cancelled)
+    message = "Command was cancelled: ";
+  else if (result.timed_out)
+    message = "Command timed out: ";
+  else
+    message = "Command failed with exit code " + std::to_string(result.exit_code) + ": ";
+  message += format_command(command);
+  if (!result.error_tail.empty()) {
+    message += "\n" + result.error_tail;
+  }
+  throw std::runtime_error(message);
+}
+
+void ProcessExecutor::set_max_processes(std::size_t max_processes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  this->max_processes = max_processes == 0 ? hardware_threads() : max_processes;
+  queue_changed.notify_all();
+}
+
+void ProcessExecutor::set_default_timeout(std::chrono::milliseconds timeout) { default_timeout = timeout.count(); }
+
+void ProcessExecutor::cancel() noexcept { cancel_requested = true; }
+
+bool ProcessExecutor::cancelled() const noexcept { return cancel_requested; }
+
+void ProcessExecutor::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    idle_count++;
+    queue_changed.wait(lock, [&] { return stopping || (!queue.empty() && running_count < max_processes); });
+    idle_count--;
+    if (queue.empty()) {
+      return;
+    }
+
+    Task task = std::move(queue.front());
+    queue.pop_front();
+    running_count++;
+    lock.unlock();
+
+    const std::chrono::milliseconds timeout =
+        task.options.timeout.count() != 0 ? task.options.timeout : std::chrono::milliseconds(default_timeout.load());
+    try {
+      task.promise.set_value(run_process(task.command, task.options, timeout, cancel_requested));
+    } catch (...) {
+      task.promise.set_exception(std::current_exception());
+    }
+
+    lock.lock();
+    running_count--;
+    queue_changed.notify_one();
+  }
+}
+
+std::string format_command(const Command &command) {
+  std::ostringstream formatted;
+  for (std::size_t i = 0; i < command.size(); i++) {
+    const std::string &argument = command[i];
+    formatted << (i == 0 ? "" : " ");
+    if (argument.empty() || argument.find_first_of(" \t\"") != std::string::npos)
+      formatted << '"' << argument << '"';
+    else
+      formatted << argument;
+  }
+  return formatted.str();
+}
+
+std::vector<std::string> split_arguments(const std::string &arguments) {
+  std::vector<std::string> split;
+  std::istringstream stream(arguments);
+  std::string argument;
+  while (stream >> argument) {
+    split.push_back(argument);
+  }
+  return split;
+}
+
+void execute_command(const Command &command, bool verbose) {
+  ProcessOptions options;
+  options.verbose = verbose;
+  ProcessExecutor::global().run(command, options);
+}
+
+std::string execute_command_output(const Command &command) {
+  ProcessOptions options;
+  options.capture_output = true;
+  return ProcessExecutor::global().run(command, options).output;
+}
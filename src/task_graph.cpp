@@ -0,0 +1,180 @@
+// Source code of the work-stealing task graph that MarkovProcessor schedules its steps on.
+//
+// EVA License
+
+#include "task_graph.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+struct WorkQueue {
+  std::mutex mutex;
+  std::deque<TaskGraph::TaskId> tasks;
+};
+} // namespace
+
+TaskGraph::TaskId TaskGraph::add(std::string name, std::function<void()> work,
+                                 const std::vector<TaskId> &dependencies) {
+  const TaskId id = tasks.size();
+  for (TaskId dependency : dependencies) {
+    if (dependency >= id) {
+      throw std::invalid_argument("Task " + name + " depends on an unknown task.");
+    }
+  }
+  tasks.push_back({std::move(name), std::move(work), {}, dependencies.size()});
+  for (TaskId dependency : dependencies) {
+    tasks[dependency].dependents.push_back(id);
+  }
+  return id;
+}
+
+void TaskGraph::run(std::size_t thread_count) {
+  const std::size_t task_count = tasks.size();
+  if (thread_count == 0) {
+    thread_count = hardware_threads();
+  }
+  thread_count = std::max<std::size_t>(1, std::min(thread_count, task_count));
+
+  std::vector<WorkQueue> queues(thread_count);
+  const std::unique_ptr<std::atomic<std::size_t>[]> waiting(new std::atomic<std::size_t>[task_count]);
+  // Set once a dependency failed or was skipped, so the task is skipped too.
+  const std::unique_ptr<std::atomic<bool>[]> blocked(new std::atomic<bool>[task_count]);
+  std::vector<std::string> errors(task_count);
+  std::atomic<std::size_t> unfinished_count{task_count};
+  // Signed, since a task can be taken before the thread that pushed it has counted it.
+  std::atomic<std::ptrdiff_t> ready_count{0};
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  std::mutex output_mutex;
+
+  auto push = [&](std::size_t queue_index, TaskId id) {
+    {
+      std::lock_guard<std::mutex> lock(queues[queue_index].mutex);
+      queues[queue_index].tasks.push_back(id);
+    }
+    // The count is raised under the sleep mutex, so a thread about to sleep sees it or is woken up.
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    ready_count++;
+    wake.notify_one();
+  };
+
+  // Takes the newest task of the thread's own queue, or else the oldest task of another one.
+  auto take = [&](std::size_t queue_index) -> std::optional<TaskId> {
+    for (std::size_t k = 0; k < thread_count; k++) {
+      WorkQueue &queue = queues[(queue_index + k) % thread_count];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      TaskId id;
+      if (k == 0) {
+        id = queue.tasks.back();
+        queue.tasks.pop_back();
+      } else {
+        id = queue.tasks.front();
+        queue.tasks.pop_front();
+      }
+      ready_count--;
+      return id;
+    }
+    return std::nullopt;
+  };
+
+  auto execute = [&](std::size_t queue_index, TaskId id) {
+    Task &task = tasks[id];
+    const bool skipped = blocked[id];
+    if (!skipped) {
+      try {
+        task.work();
+      } catch (const std::exception &err) {
+        errors[id] = err.what();
+      } catch (...) {
+        errors[id] = "unknown error";
+      }
+      if (!errors[id].empty()) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "Failed to " << task.name << ": " << errors[id] << std::endl;
+      }
+    }
+    const bool failed = skipped || !errors[id].empty();
+    // Pushed in reverse, so that the first dependent is the next task this thread runs.
+    for (auto dependent = task.dependents.rbegin(); dependent != task.dependents.rend(); ++dependent) {
+      if (failed) {
+        blocked[*dependent] = true;
+      }
+      if (--waiting[*dependent] == 0) {
+        push(queue_index, *dependent);
+      }
+    }
+    if (--unfinished_count == 0) {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      wake.notify_all();
+    }
+  };
+
+  for (TaskId id = 0; id < task_count; id++) {
+    waiting[id] = tasks[id].dependency_count;
+    blocked[id] = false;
+  }
+  // The tasks without dependencies are dealt out so that every thread starts with the lowest ids of its share.
+  std::size_t next_queue = 0;
+  for (TaskId id = task_count; id-- > 0;) {
+    if (tasks[id].dependency_count == 0) {
+      queues[next_queue].tasks.push_back(id);
+      ready_count++;
+      next_queue = (next_queue + 1) % thread_count;
+    }
+  }
+
+  auto worker = [&](std::size_t queue_index) {
+    while (unfinished_count != 0) {
+      if (const std::optional<TaskId> id = take(queue_index)) {
+        execute(queue_index, *id);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      wake.wait(lock, [&] { return ready_count > 0 || unfinished_count == 0; });
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(thread_count - 1);
+  for (std::size_t t = 1; t < thread_count; t++) {
+    threads.emplace_back(worker, t);
+  }
+  worker(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::ostringstream failed;
+  std::size_t failed_count = 0;
+  std::size_t skipped_count = 0;
+  for (TaskId id = 0; id < task_count; id++) {
+    if (!errors[id].empty()) {
+      failed << (failed_count++ == 0 ? "" : ", ") << tasks[id].name;
+    } else if (blocked[id]) {
+      skipped_count++;
+    }
+  }
+  if (failed_count != 0) {
+    throw std::runtime_error(std::to_string(failed_count) + " of " + std::to_string(task_count) +
+                             " tasks failed: " + failed.str() + ". " + std::to_string(skipped_count) +
+                             " tasks that depend on them were skipped.");
+  }
+}
@@ -0,0 +1,652 @@
+#include "transition_matrix.hpp"
+#include "helpers.hpp"
+#include "kernels.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+// Binary matrix files start with a 64 byte header followed by the payload in native byte order. Dense payloads are the
+// row-major values, sparse payloads are the row offsets (rows + 1 uint64), the values (double) and the columns
+// (uint32). Every array is 8 byte aligned relative to the start of the file, so it can be used straight from a mapping.
+constexpr char BINARY_MAGIC[8] = {'M', 'K', 'V', 'C', 'H', 'A', 'I', 'N'};
+constexpr std::uint32_t BINARY_VERSION = 1;
+constexpr std::uint32_t BINARY_BYTE_ORDER = 0x01020304;
+constexpr std::uint32_t BINARY_DENSE = 0;
+constexpr std::uint32_t BINARY_SPARSE = 1;
+
+struct BinaryHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint32_t layout;
+  std::uint32_t reserved;
+  std::uint64_t rows;
+  std::uint64_t columns;
+  std::uint64_t stored_count;
+  char padding[16];
+};
+static_assert(sizeof(BinaryHeader) == 64, "Binary matrix header must be 64 bytes.");
+
+bool is_binary_matrix(const MappedFile &mapping) {
+  return mapping.size() >= sizeof(BINARY_MAGIC) &&
+         std::memcmp(mapping.data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+[[noreturn]] void throw_parse_error(const fs::path &markov_file, std::size_t line, std::size_t column,
+                                    const std::string &message) {
+  throw std::invalid_argument("Could not parse markov chain file " + markov_file.string() + " at line " +
+                              std::to_string(line) + ", column " + std::to_string(column) + ": " + message);
+}
+
+void skip_blanks(const char *&cursor, const char *end) {
+  while (cursor < end && is_blank(*cursor)) {
+    cursor++;
+  }
+}
+
+// Parses the comma seperated text format in a single pass over the mapped file. If contexts is not nullptr every line
+// must start with a context of order states, "c1 c2 ... ck:", which is appended to contexts. order is set from the
+// first line.
+TransitionMatrix parse_text_matrix(const MappedFile &mapping, MatrixStorage storage, const fs::path &markov_file,
+                                   std::vector<std::uint32_t> *contexts, std::size_t &order) {
+  TransitionMatrix transition_matrix;
+  std::vector<double> row;
+
+  const char *cursor = mapping.data();
+  const char *const end = cursor + mapping.size();
+  std::size_t line_number = 1;
+
+  while (cursor < end) {
+    const char *const line_start = cursor;
+    const char *line_end = static_cast<const char *>(std::memchr(cursor, '\n', end - cursor));
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+    auto column_of = [&](const char *position) { return static_cast<std::size_t>(position - line_start) + 1; };
+
+    row.clear();
+    skip_blanks(cursor, line_end);
+
+    const char *colon =
+        cursor < line_end ? static_cast<const char *>(std::memchr(cursor, ':', line_end - cursor)) : nullptr;
+    if (colon != nullptr) {
+      if (contexts == nullptr) {
+        throw_parse_error(markov_file, line_number, column_of(colon),
+                          "contexts are only allowed in higher-order chain files.");
+      }
+      std::size_t context_length = 0;
+      while (cursor < colon) {
+        std::uint32_t context_state;
+        const auto [next, error] = std::from_chars(cursor, colon, context_state);
+        if (error != std::errc()) {
+          throw_parse_error(markov_file, line_number, column_of(cursor), "expected a state of the context.");
+        }
+        contexts->push_back(context_state);
+        context_length++;
+        cursor = next;
+        skip_blanks(cursor, colon);
+      }
+      if (context_length == 0) {
+        throw_parse_error(markov_file, line_number, column_of(cursor), "expected a state of the context.");
+      }
+      if (order == 0) {
+        order = context_length;
+      } else if (context_length != order) {
+        throw_parse_error(markov_file, line_number, 1,
+                          "context has " + std::to_string(context_length) + " states, expected " +
+                              std::to_string(order) + ".");
+      }
+      cursor = colon + 1;
+      skip_blanks(cursor, line_end);
+      if (cursor == line_end) {
+        throw_parse_error(markov_file, line_number, column_of(cursor), "expected a probability.");
+      }
+    } else if (contexts != nullptr && cursor < line_end) {
+      throw_parse_error(markov_file, line_number, column_of(cursor), "expected a context followed by ':'.");
+    }
+
+    // Blank lines, including a trailing one, are skipped.
+    while (cursor < line_end) {
+      double value;
+      const auto [next, error] = std::from_chars(cursor, line_end, value);
+      if (error != std::errc() || !std::isfinite(value)) {
+        throw_parse_error(markov_file, line_number, column_of(cursor), "expected a probability.");
+      }
+      row.push_back(value);
+
+      cursor = next;
+      skip_blanks(cursor, line_end);
+      if (cursor == line_end) {
+        break;
+      }
+      if (*cursor != ',') {
+        throw_parse_error(markov_file, line_number, column_of(cursor), "expected ','.");
+      }
+      cursor++;
+      skip_blanks(cursor, line_end);
+      if (cursor == line_end) {
+        throw_parse_error(markov_file, line_number, column_of(cursor), "expected a probability after ','.");
+      }
+    }
+
+    if (!row.empty()) {
+      if (transition_matrix.size() > 0 && row.size() != transition_matrix.column_count()) {
+        throw_parse_error(markov_file, line_number, 1,
+                          "row has " + std::to_string(row.size()) + " values, expected " +
+                              std::to_string(transition_matrix.column_count()) + ".");
+      }
+      transition_matrix.append_row(row);
+    }
+
+    cursor = line_end + 1;
+    line_number++;
+  }
+
+  transition_matrix.finalize(storage);
+  return transition_matrix;
+}
+
+template <typename T> void write_array(std::ofstream &output, const T *data, std::size_t count) {
+  output.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(count * sizeof(T)));
+}
+} // namespace
+
+TransitionMatrix::TransitionMatrix() : row_offsets{0} { bind(); }
+
+TransitionMatrix::TransitionMatrix(const std::vector<std::vector<double>> &rows, MatrixStorage storage)
+    : TransitionMatrix() {
+  for (const auto &row : rows) {
+    append_row(row);
+  }
+  finalize(storage);
+}
+
+TransitionMatrix::TransitionMatrix(const TransitionMatrix &other)
+    : rows(other.rows), columns(other.columns), sparse(other.sparse), values(other.values),
+      column_indices(other.column_indices), row_offsets(other.row_offsets), mapping(other.mapping),
+      value_data(other.value_data), column_data(other.column_data), offset_data(other.offset_data),
+      value_count(other.value_count) {
+  if (!mapping) {
+    bind();
+  }
+}
+
+TransitionMatrix::TransitionMatrix(TransitionMatrix &&other) noexcept
+    : rows(other.rows), columns(other.columns), sparse(other.sparse), values(std::move(other.values)),
+      column_indices(std::move(other.column_indices)), row_offsets(std::move(other.row_offsets)),
+      mapping(std::move(other.mapping)), value_data(other.value_data), column_data(other.column_data),
+      offset_data(other.offset_data), value_count(other.value_count) {
+  if (!mapping) {
+    bind();
+  }
+}
+
+TransitionMatrix &TransitionMatrix::operator=(const TransitionMatrix &other) {
+  if (this != &other) {
+    *this = TransitionMatrix(other);
+  }
+  return *this;
+}
+
+TransitionMatrix &TransitionMatrix::operator=(TransitionMatrix &&other) noexcept {
+  rows = other.rows;
+  columns = other.columns;
+  sparse = other.sparse;
+  values = std::move(other.values);
+  column_indices = std::move(other.column_indices);
+  row_offsets = std::move(other.row_offsets);
+  mapping = std::move(other.mapping);
+  value_data = other.value_data;
+  column_data = other.column_data;
+  offset_data = other.offset_data;
+  value_count = other.value_count;
+  if (!mapping) {
+    bind();
+  }
+  return *this;
+}
+
+void TransitionMatrix::bind() {
+  value_data = values.data();
+  column_data = column_indices.data();
+  offset_data = row_offsets.data();
+  value_count = values.size();
+}
+
+void TransitionMatrix::detach() {
+  if (!mapping) {
+    return;
+  }
+  values.assign(value_data, value_data + value_count);
+  if (sparse) {
+    column_indices.assign(column_data, column_data + value_count);
+    row_offsets.assign(offset_data, offset_data + rows + 1);
+  } else {
+    column_indices.clear();
+    row_offsets.clear();
+  }
+  mapping.reset();
+  bind();
+}
+
+void TransitionMatrix::append_row(const std::vector<double> &row) {
+  if (!sparse || mapping) {
+    throw std::logic_error("Cannot append rows to a finalized transition matrix.");
+  }
+  if (rows == 0) {
+    if (row.size() > std::numeric_limits<std::uint32_t>::max()) {
+      throw std::invalid_argument("Transition matrix has too many states.");
+    }
+    columns = row.size();
+  } else if (row.size() != columns) {
+    throw std::invalid_argument("Transition matrix is not a square matrix.");
+  }
+
+  // Negative values are kept so that validation can still reject them.
+  for (std::size_t j = 0; j < row.size(); j++) {
+    if (std::fpclassify(row[j]) != FP_ZERO) {
+      values.push_back(row[j]);
+      column_indices.push_back(static_cast<std::uint32_t>(j));
+    }
+  }
+  row_offsets.push_back(values.size());
+  rows++;
+  bind();
+}
+
+void TransitionMatrix::append_sparse_row(const std::vector<std::uint32_t> &row_columns,
+                                         const std::vector<double> &row_values, std::size_t width) {
+  if (!sparse || mapping) {
+    throw std::logic_error("Cannot append rows to a finalized transition matrix.");
+  }
+  if (rows == 0) {
+    columns = width;
+  } else if (width != columns) {
+    throw std::invalid_argument("Transition matrix is not a square matrix.");
+  }
+
+  values.insert(values.end(), row_values.begin(), row_values.end());
+  column_indices.insert(column_indices.end(), row_columns.begin(), row_columns.end());
+  row_offsets.push_back(values.size());
+  rows++;
+  bind();
+}
+
+void TransitionMatrix::finalize(MatrixStorage storage) {
+  if (!sparse || mapping) {
+    return;
+  }
+
+  if (storage == MatrixStorage::Auto) {
+    const double dense_bytes = static_cast<double>(rows) * static_cast<double>(columns) * sizeof(double);
+    const double sparse_bytes = static_cast<double>(values.size()) * (sizeof(double) + sizeof(std::uint32_t)) +
+                                static_cast<double>(row_offsets.size()) * sizeof(std::uint64_t);
+    storage = dense_bytes <= sparse_bytes ? MatrixStorage::Dense : MatrixStorage::Sparse;
+  }
+
+  if (storage == MatrixStorage::Sparse) {
+    values.shrink_to_fit();
+    column_indices.shrink_to_fit();
+    row_offsets.shrink_to_fit();
+    bind();
+    return;
+  }
+
+  std::vector<double> dense(rows * columns, 0.0);
+  for (std::size_t i = 0; i < rows; i++) {
+    for (std::size_t k = row_offsets[i]; k < row_offsets[i + 1]; k++) {
+      dense[i * columns + column_indices[k]] = values[k];
+    }
+  }
+
+  values = std::move(dense);
+  column_indices = std::vector<std::uint32_t>();
+  row_offsets = std::vector<std::uint64_t>();
+  sparse = false;
+  bind();
+}
+
+std::size_t TransitionMatrix::size() const { return rows; }
+
+std::size_t TransitionMatrix::column_count() const { return columns; }
+
+std::size_t TransitionMatrix::stored_count() const { return value_count; }
+
+bool TransitionMatrix::is_sparse() const { return sparse; }
+
+TransitionRow TransitionMatrix::row(std::size_t i) const {
+  if (sparse) {
+    return {value_data + offset_data[i], column_data + offset_data[i],
+            static_cast<std::size_t>(offset_data[i + 1] - offset_data[i])};
+  }
+  return {value_data + i * columns, nullptr, columns};
+}
+
+double TransitionMatrix::probability(std::size_t i, std::size_t j) const {
+  if (!sparse) {
+    return value_data[i * columns + j];
+  }
+
+  const std::uint32_t *first = column_data + offset_data[i];
+  const std::uint32_t *last = column_data + offset_data[i + 1];
+  const std::uint32_t *it = std::lower_bound(first, last, static_cast<std::uint32_t>(j));
+  return (it != last && *it == j) ? value_data[it - column_data] : 0.0;
+}
+
+void TransitionMatrix::normalize_rows() {
+  detach();
+  for (std::size_t i = 0; i < rows; i++) {
+    const TransitionRow view = row(i);
+    double *row_values = values.data() + (view.values - value_data);
+    const double sum = compensated_sum_kernel(view.values, view.count);
+    if (sum > 0.0) {
+      for (std::size_t k = 0; k < view.count; k++) {
+        row_values[k] /= sum;
+      }
+    }
+  }
+}
+
+TransitionMatrix TransitionMatrix::transposed() const {
+  TransitionMatrix transpose;
+  transpose.rows = columns;
+  transpose.columns = rows;
+  transpose.sparse = sparse;
+
+  if (!sparse) {
+    transpose.values.resize(rows * columns);
+    for (std::size_t i = 0; i < rows; i++) {
+      for (std::size_t j = 0; j < columns; j++) {
+        transpose.values[j * rows + i] = value_data[i * columns + j];
+      }
+    }
+    transpose.row_offsets.clear();
+    transpose.bind();
+    return transpose;
+  }
+
+  // Counting sort by column. Rows are visited in order, so the columns of every transposed row stay sorted.
+  transpose.row_offsets.assign(columns + 1, 0);
+  for (std::size_t k = 0; k < value_count; k++) {
+    transpose.row_offsets[column_data[k] + 1]++;
+  }
+  for (std::size_t j = 0; j < columns; j++) {
+    transpose.row_offsets[j + 1] += transpose.row_offsets[j];
+  }
+
+  transpose.values.resize(value_count);
+  transpose.column_indices.resize(value_count);
+  std::vector<std::uint64_t> next(transpose.row_offsets.begin(), transpose.row_offsets.end() - 1);
+  for (std::size_t i = 0; i < rows; i++) {
+    for (std::size_t k = offset_data[i]; k < offset_data[i + 1]; k++) {
+      const std::uint64_t position = next[column_data[k]]++;
+      transpose.values[position] = value_data[k];
+      transpose.column_indices[position] = static_cast<std::uint32_t>(i);
+    }
+  }
+  transpose.bind();
+  return transpose;
+}
+
+TransitionMatrix TransitionMatrix::from_binary(std::shared_ptr<const MappedFile> mapping) {
+  const std::size_t file_size = mapping->size();
+  BinaryHeader header;
+  if (file_size < sizeof(header)) {
+    throw std::invalid_argument("Binary matrix file is too small.");
+  }
+  std::memcpy(&header, mapping->data(), sizeof(header));
+
+  if (std::memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) {
+    throw std::invalid_argument("Not a binary matrix file.");
+  }
+  if (header.byte_order != BINARY_BYTE_ORDER) {
+    throw std::invalid_argument("Binary matrix file was written on a machine with a different byte order.");
+  }
+  if (header.version != BINARY_VERSION) {
+    throw std::invalid_argument("Unsupported binary matrix file version " + std::to_string(header.version) + ".");
+  }
+  if (header.layout != BINARY_DENSE && header.layout != BINARY_SPARSE) {
+    throw std::invalid_argument("Unknown binary matrix layout.");
+  }
+  if (header.columns > std::numeric_limits<std::uint32_t>::max() ||
+      header.rows > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::invalid_argument("Transition matrix has too many states.");
+  }
+
+  TransitionMatrix transition_matrix;
+  transition_matrix.rows = header.rows;
+  transition_matrix.columns = header.columns;
+  transition_matrix.sparse = header.layout == BINARY_SPARSE;
+  transition_matrix.value_count = header.stored_count;
+
+  const char *payload = mapping->data() + sizeof(header);
+  const std::size_t payload_size = file_size - sizeof(header);
+
+  if (!transition_matrix.sparse) {
+    if (header.stored_count != header.rows * header.columns || payload_size % sizeof(double) != 0 ||
+        payload_size / sizeof(double) != header.stored_count) {
+      throw std::invalid_argument("Binary matrix file has the wrong size.");
+    }
+    transition_matrix.value_data = reinterpret_cast<const double *>(payload);
+    transition_matrix.column_data = nullptr;
+    transition_matrix.offset_data = nullptr;
+  } else {
+    if (header.stored_count > payload_size / (sizeof(double) + sizeof(std::uint32_t))) {
+      throw std::invalid_argument("Binary matrix file has the wrong size.");
+    }
+    const std::size_t offsets_size = (header.rows + 1) * sizeof(std::uint64_t);
+    const std::size_t values_size = header.stored_count * sizeof(double);
+    const std::size_t columns_size = header.stored_count * sizeof(std::uint32_t);
+    if (payload_size != offsets_size + values_size + columns_size) {
+      throw std::invalid_argument("Binary matrix file has the wrong size.");
+    }
+    transition_matrix.offset_data = reinterpret_cast<const std::uint64_t *>(payload);
+    transition_matrix.value_data = reinterpret_cast<const double *>(payload + offsets_size);
+    transition_matrix.column_data = reinterpret_cast<const std::uint32_t *>(payload + offsets_size + values_size);
+
+    // Every row must be in bounds with strictly increasing columns, otherwise lookups would read garbage.
+    const std::uint64_t *offsets = transition_matrix.offset_data;
+    const std::uint32_t *row_columns = transition_matrix.column_data;
+    if (offsets[0] != 0 || offsets[header.rows] != header.stored_count) {
+      throw std::invalid_argument("Binary matrix file has corrupt row offsets.");
+    }
+    for (std::size_t i = 0; i < header.rows; i++) {
+      if (offsets[i] > offsets[i + 1]) {
+        throw std::invalid_argument("Binary matrix file has corrupt row offsets.");
+      }
+      for (std::size_t k = offsets[i]; k < offsets[i + 1]; k++) {
+        if (row_columns[k] >= header.columns || (k > offsets[i] && row_columns[k] <= row_columns[k - 1])) {
+          throw std::invalid_argument("Binary matrix file has corrupt columns in row " + std::to_string(i) + ".");
+        }
+      }
+    }
+  }
+
+  // Sampling looks up the rows of the states it reaches, so reading ahead of them would only waste memory.
+  mapping->advise(MappedFile::Access::Random);
+  transition_matrix.mapping = std::move(mapping);
+  return transition_matrix;
+}
+
+void TransitionMatrix::write_binary(const fs::path &output_path) const {
+  std::ofstream output(output_path, std::ios::binary);
+  if (!output.is_open()) {
+    throw std::runtime_error("Cannot open file: " + output_path.string());
+  }
+
+  BinaryHeader header{};
+  std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+  header.version = BINARY_VERSION;
+  header.byte_order = BINARY_BYTE_ORDER;
+  header.layout = sparse ? BINARY_SPARSE : BINARY_DENSE;
+  header.rows = rows;
+  header.columns = columns;
+  header.stored_count = value_count;
+  output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  if (sparse) {
+    write_array(output, offset_data, rows + 1);
+    write_array(output, value_data, value_count);
+    write_array(output, column_data, value_count);
+  } else {
+    write_array(output, value_data, value_count);
+  }
+
+  if (!output) {
+    throw std::runtime_error("Error writing binary matrix file: " + output_path.string());
+  }
+}
+
+std::vector<InvalidRow> find_invalid_rows(const TransitionMatrix &transition_matrix, double epsilon,
+                                          std::size_t thread_count) {
+  const std::size_t rows = transition_matrix.size();
+  const std::size_t blocks = (rows + constants::PARALLEL_ROW_BLOCK - 1) / constants::PARALLEL_ROW_BLOCK;
+  if (transition_matrix.stored_count() < constants::PARALLEL_MIN_ENTRIES) {
+    thread_count = 1;
+  }
+
+  // Every block collects its own rows, which keeps the result ordered without any locking.
+  std::vector<std::vector<InvalidRow>> block_invalid_rows(blocks);
+  parallel_for(blocks, thread_count, [&](std::size_t block) {
+    const std::size_t first = block * constants::PARALLEL_ROW_BLOCK;
+    const std::size_t last = std::min(rows, first + constants::PARALLEL_ROW_BLOCK);
+    for (std::size_t i = first; i < last; i++) {
+      const TransitionRow row = transition_matrix.row(i);
+      const double sum = sum_kernel(row.values, row.count);
+      const bool has_negative = min_kernel(row.values, row.count) < 0.0;
+      // The negated comparison also catches a sum of NaN.
+      if (has_negative || !(std::fabs(sum - 1.0) <= epsilon)) {
+        block_invalid_rows[block].push_back({i, sum, has_negative});
+      }
+    }
+  });
+
+  std::vector<InvalidRow> invalid_rows;
+  for (const auto &block : block_invalid_rows) {
+    invalid_rows.insert(invalid_rows.end(), block.begin(), block.end());
+  }
+  return invalid_rows;
+}
+
+void throw_if_invalid_rows(const TransitionMatrix &transition_matrix, double epsilon) {
+  const std::vector<InvalidRow> invalid_rows = find_invalid_rows(transition_matrix, epsilon);
+  if (invalid_rows.empty()) {
+    return;
+  }
+
+  std::ostringstream message;
+  message << "Transition matrix has " << invalid_rows.size()
+          << " invalid rows. Probabilities must be non-negative and sum to 1, use --normalize to rescale the rows.";
+  for (std::size_t i = 0; i < invalid_rows.size() && i < constants::MAX_REPORTED_ROWS; i++) {
+    const InvalidRow &invalid_row = invalid_rows[i];
+    message << "\n  row " << invalid_row.row << ": "
+            << (invalid_row.has_negative ? "has negative probabilities, " : "") << "sums to "
+            << std::setprecision(17) << invalid_row.sum;
+  }
+  if (invalid_rows.size() > constants::MAX_REPORTED_ROWS) {
+    message << "\n  and " << invalid_rows.size() - constants::MAX_REPORTED_ROWS << " more.";
+  }
+  throw std::invalid_argument(message.str());
+}
+
+TransitionMatrix read_transition_matrix(const fs::path &markov_file, MatrixStorage storage) {
+  std::shared_ptr<const MappedFile> mapping;
+  try {
+    mapping = std::make_shared<const MappedFile>(markov_file);
+  } catch (const std::runtime_error &) {
+    throw std::invalid_argument("Could not read markov chain file.");
+  }
+
+  if (!is_binary_matrix(*mapping)) {
+    std::size_t order = 0;
+    return parse_text_matrix(*mapping, storage, markov_file, nullptr, order);
+  }
+
+  TransitionMatrix transition_matrix = TransitionMatrix::from_binary(std::move(mapping));
+  const bool layout_matches = storage == MatrixStorage::Auto ||
+                              (storage == MatrixStorage::Sparse) == transition_matrix.is_sparse();
+  if (layout_matches) {
+    return transition_matrix;
+  }
+
+  // Only an explicitly requested layout that differs from the file's is worth copying the matrix for.
+  TransitionMatrix converted;
+  std::vector<double> row(transition_matrix.column_count());
+  for (std::size_t i = 0; i < transition_matrix.size(); i++) {
+    const TransitionRow view = transition_matrix.row(i);
+    std::fill(row.begin(), row.end(), 0.0);
+    for (std::size_t k = 0; k < view.count; k++) {
+      row[view.column(k)] = view.values[k];
+    }
+    converted.append_row(row);
+  }
+  converted.finalize(storage);
+  return converted;
+}
+
+ContextMatrix read_context_matrix(const fs::path &markov_file, MatrixStorage storage) {
+  std::unique_ptr<const MappedFile> mapping;
+  try {
+    mapping = std::make_unique<const MappedFile>(markov_file);
+  } catch (const std::runtime_error &) {
+    throw std::invalid_argument("Could not read markov chain file.");
+  }
+  if (is_binary_matrix(*mapping)) {
+    throw std::invalid_argument("Higher-order chains can only be read from text files.");
+  }
+
+  ContextMatrix context_matrix;
+  context_matrix.order = 0;
+  context_matrix.transitions =
+      parse_text_matrix(*mapping, storage, markov_file, &context_matrix.contexts, context_matrix.order);
+  return context_matrix;
+}
+
+bool is_context_matrix_file(const fs::path &markov_file) {
+  std::ifstream mc_file(markov_file, std::ios::binary);
+  // Binary matrices are never higher-order, and their header or payload may hold a ':' byte.
+  char magic[sizeof(BINARY_MAGIC)];
+  if (mc_file.read(magic, sizeof(magic)) && std::memcmp(magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0) {
+    return false;
+  }
+  mc_file.clear();
+  mc_file.seekg(0);
+  std::string line;
+  while (std::getline(mc_file, line)) {
+    if (line.find_first_not_of(" \t\r") != std::string::npos) {
+      return line.find(':') != std::string::npos;
+    }
+  }
+  return false;
+}
+
+MatrixStorage matrix_storage_from_string(const std::string &name) {
+  if (name == "auto")
+    return MatrixStorage::Auto;
+  else if (name == "dense")
+    return MatrixStorage::Dense;
+  else if (name == "sparse")
+    return MatrixStorage::Sparse;
+  else
+    throw std::invalid_argument("Unknown matrix storage: " + name);
+}
@@ -1,136 +1,213 @@
 #include "visuals.hpp"
+#include "canvas.hpp"
+#include "graph_layout.hpp"
 #include "helpers.hpp"
 #include "markov.hpp"
+#include "process.hpp"
 #include <cstddef>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-namespace fs = std::filesystem;
+#ifdef MARKOV_VIDEO_POPPLER
+#include <poppler-document.h>
+#include <poppler-image.h>
+#include <poppler-page-renderer.h>
+#include <poppler-page.h>
+#endif
 
-void generate_markov_graph(const MarkovChain &mc, const fs::path &output_path, std::size_t highlight_index,
-                           const std::string &highlight_color) {
-  const std::vector<std::vector<double>> &transitionMatrix = mc.get_transition_matrix();
-  const std::vector<std::string> &state_names = mc.get_state_names();
-  const std::size_t &n = transitionMatrix.size();
-  const std::size_t &nodesPerRow = 3;  // Number of nodes per row
-  const double &verticalOffset = -1.5; // Vertical offset for the second row
+namespace fs = std::filesystem;
 
-  std::ofstream markov_graph_latex(output_path);
-  if (!markov_graph_latex.is_open()) {
-    throw std::runtime_error("Cannot open file.");
+namespace {
+const char *label_position(LabelPlacement label) {
+  switch (label) {
+  case LabelPlacement::Above:
+    return "above";
+  case LabelPlacement::Below:
+    return "below";
+  default:
+    return "auto";
   }
-
-  markov_graph_latex << constants::DEFAULT_LATEX_PREAMBLE;
-
-  // Define nodes in two rows
-  for (std::size_t i = 0; i < n; ++i) {
-    const double &yPosition = (i / nodesPerRow) * verticalOffset; // Calculate y position based on row
-    if (i == highlight_index) {
-      markov_graph_latex << "    \\node[state, fill=" << highlight_color << "] (S" << i << ") at (" << (i % nodesPerRow)
-                         << ", " << yPosition << ") {" << state_names[i] << "};\n";
-    } else {
-      markov_graph_latex << "    \\node[state] (S" << i << ") at (" << (i % nodesPerRow) << ", " << yPosition << ") {"
-                         << state_names[i] << "};\n";
-    }
+}
+} // namespace
+
+MarkovGraphPicture::MarkovGraphPicture(const MarkovModel &mc, const GraphLayout &layout) {
+  std::ostringstream markov_graph_latex;
+  markov_graph_latex << constants::DEFAULT_LATEX_PICTURE_BEGIN;
+
+  // Define nodes
+  fill_offsets.reserve(layout.positions.size());
+  for (std::size_t i = 0; i < layout.positions.size(); ++i) {
+    const Point &position = layout.positions[i];
+    markov_graph_latex << "    \\node[state";
+    fill_offsets.push_back(static_cast<std::size_t>(markov_graph_latex.tellp()));
+    markov_graph_latex << "] (S" << i << ") at (" << position.x << ", " << position.y << ") {"
+                       << mc.get_state_name(i) << "};\n";
   }
 
   // Define edges
-  for (std::size_t i = 0; i < n; ++i) {
-    for (std::size_t j = 0; j < n; ++j) {
-      if (transitionMatrix[i][j] > 0) {
-        if (i == j) {
-          // Self-loop
-          markov_graph_latex << "    \\path[->] (S" << i << ") edge[loop above] node {" << std::fixed
-                             << std::setprecision(2) << transitionMatrix[i][j] << "} (S" << i << ");\n";
-        } else {
-          // Determine the position of the nodes
-          bool isLeftNode = (i % nodesPerRow) < (j % nodesPerRow);
-          bool isSameRow = (i / nodesPerRow) == (j / nodesPerRow);
-
-          if ((j - i) % 2 == 0) {
-            // Right bending edge
-            markov_graph_latex << "    \\path[->] (S" << i << ") edge[bend left] node["
-                               << (isSameRow ? (isLeftNode ? "above" : "below") : "above") << "] {" << std::fixed
-                               << std::setprecision(2) << transitionMatrix[i][j] << "} (S" << j << ");\n";
-          } else {
-            // Left bending edge
-            markov_graph_latex << "    \\path[->] (S" << i << ") edge[bend right] node["
-                               << (isSameRow ? (isLeftNode ? "below" : "above") : "below") << "] {" << std::fixed
-                               << std::setprecision(2) << transitionMatrix[i][j] << "} (S" << j << ");\n";
-          }
-        }
-      }
+  const std::ios_base::fmtflags flags = markov_graph_latex.flags();
+  const std::streamsize precision = markov_graph_latex.precision();
+  for (const LayoutEdge &edge : layout.edges) {
+    markov_graph_latex.flags(flags);
+    markov_graph_latex.precision(precision);
+    switch (edge.shape) {
+    case EdgeShape::Loop:
+      markov_graph_latex << "    \\path[->] (S" << edge.from << ") edge[loop above] node {";
+      break;
+    case EdgeShape::Left:
+      markov_graph_latex << "    \\path[->] (S" << edge.from << ") edge[bend left] node[" << label_position(edge.label)
+                         << "] {";
+      break;
+    case EdgeShape::Right:
+      markov_graph_latex << "    \\path[->] (S" << edge.from << ") edge[bend right] node["
+                         << label_position(edge.label) << "] {";
+      break;
+    case EdgeShape::Straight:
+      markov_graph_latex << "    \\path[->] (S" << edge.from << ") edge node[" << label_position(edge.label) << "] {";
+      break;
+    case EdgeShape::Bundled:
+      // Bundled edges carry no label, they would pile up along the shared path.
+      markov_graph_latex << "    \\draw[->] (S" << edge.from << ") .. controls (" << edge.control_from.x << ", "
+                         << edge.control_from.y << ") and (" << edge.control_to.x << ", " << edge.control_to.y
+                         << ") .. (S" << edge.to << ");\n";
+      continue;
     }
+    markov_graph_latex << std::fixed << std::setprecision(2) << edge.probability << "} (S" << edge.to << ");\n";
   }
 
   markov_graph_latex << "\\end{tikzpicture}\n";
-  markov_graph_latex << "\\end{document}\n";
+  body = markov_graph_latex.str();
 }
 
-void generate_all_markov_graphs(const MarkovChain &mc, const fs::path &output_path) {
-  const std::size_t &chain_length = mc.get_transition_matrix_size();
-  for (std::size_t i = 0; i < chain_length; i++) {
-    const fs::path &output_file_path = std::to_string(i) + ".tex";
-    std::cout << "Generating markov graph " << output_file_path << "." << std::endl;
-    generate_markov_graph(mc, output_path / output_file_path, i);
+void MarkovGraphPicture::write(std::ostream &markov_graph_latex, std::size_t highlight_index,
+                               const std::string &highlight_color) const {
+  if (highlight_index >= fill_offsets.size()) {
+    markov_graph_latex.write(body.data(), static_cast<std::streamsize>(body.size()));
+    return;
   }
+  const std::size_t offset = fill_offsets[highlight_index];
+  markov_graph_latex.write(body.data(), static_cast<std::streamsize>(offset));
+  markov_graph_latex << ", fill=" << highlight_color;
+  markov_graph_latex.write(body.data() + offset, static_cast<std::streamsize>(body.size() - offset));
 }
 
-void compile_markov_graph(const fs::path &folder_path, const fs::path &file_name,
-                          const fs::path &latex_output_directory, const std::string &latex_compiler,
-                          const std::string &latex_compiler_options, bool verbose) {
-  std::ostringstream command;
-  command << latex_compiler << " " << latex_compiler_options
-          << " -interaction=nonstopmode -output-directory=" << folder_path / latex_output_directory << " "
-          << folder_path / file_name;
+void MarkovGraphPicture::write_document(const fs::path &output_path, std::size_t highlight_index,
+                                        const std::string &highlight_color) const {
+  const std::string_view picture = body;
+  std::size_t offset = body.size();
+  if (highlight_index < fill_offsets.size()) {
+    offset = fill_offsets[highlight_index];
+  }
+  const bool highlighted = offset != body.size();
+  write_file(output_path, {constants::DEFAULT_LATEX_PREAMBLE, picture.substr(0, offset),
+                           highlighted ? ", fill=" : "", highlighted ? std::string_view(highlight_color) : "",
+                           picture.substr(offset), "\\end{document}\n"});
+}
 
-  execute_command(command, verbose);
+void write_markov_graph(std::ostream &markov_graph_latex, const MarkovModel &mc, const GraphLayout &layout,
+                        std::size_t highlight_index, const std::string &highlight_color) {
+  MarkovGraphPicture(mc, layout).write(markov_graph_latex, highlight_index, highlight_color);
 }
 
-void compile_all_markov_graphs(const fs::path &latex_folder_path, std::size_t file_count,
-                               const fs::path &latex_output_directory, const std::string &latex_compiler,
-                               const std::string &latex_compiler_options, bool verbose) {
-  const fs::path &build_file_path = latex_folder_path / latex_output_directory;
+void generate_markov_graph(const MarkovModel &mc, const GraphLayout &layout, const fs::path &output_path,
+                           std::size_t highlight_index, const std::string &highlight_color) {
+  MarkovGraphPicture(mc, layout).write_document(output_path, highlight_index, highlight_color);
+}
 
-  create_dir(build_file_path);
+void generate_markov_graph_document(const MarkovModel &mc, const GraphLayout &layout, const fs::path &output_path,
+                                    const std::string &highlight_color) {
+  std::ofstream markov_graph_latex(output_path);
+  if (!markov_graph_latex.is_open()) {
+    throw std::runtime_error("Cannot open file.");
+  }
 
-  for (std::size_t i = 0; i < file_count; i++) {
-    std::cout << "Compiling " << fs::path(std::to_string(i) + ".tex") << std::endl;
-    compile_markov_graph(latex_folder_path, std::to_string(i) + ".tex", latex_output_directory, latex_compiler,
-                         latex_compiler_options, verbose);
+  std::cout << "Generating markov graph document " << output_path << "." << std::endl;
+  const MarkovGraphPicture picture(mc, layout);
+  markov_graph_latex << constants::DEFAULT_LATEX_PREAMBLE;
+  for (std::size_t i = 0; i < mc.get_transition_matrix_size(); i++) {
+    picture.write(markov_graph_latex, i, highlight_color);
   }
+  markov_graph_latex << "\\end{document}\n";
 }
 
-void convert_pdf_to_png(const fs::path &file_path, const fs::path &output_path, bool verbose) {
-  // Ensure the input file exists
-  if (!fs::exists(file_path)) {
-    throw std::runtime_error("Input file does not exist: " + file_path.string());
+void compile_markov_graph(const fs::path &folder_path, const fs::path &file_name,
+                          const fs::path &latex_output_directory, const std::string &latex_compiler,
+                          const std::string &latex_compiler_options, bool verbose) {
+  Command command = {latex_compiler};
+  for (const std::string &option : split_arguments(latex_compiler_options)) {
+    command.push_back(option);
   }
-
-  // Construct the command using ostringstream
-  std::ostringstream command;
-  command << "magick -density 300 " << file_path << " -quality 100 -resize 200% " << output_path;
+  command.insert(command.end(), {"-interaction=nonstopmode",
+                                 "-output-directory=" + (folder_path / latex_output_directory).string(),
+                                 (folder_path / file_name).string()});
 
   execute_command(command, verbose);
 }
 
-void convert_all_pdfs_to_pngs(const fs::path &folder_path, std::size_t file_count, const fs::path &output_path,
-                              bool verbose) {
+void compile_markov_graph_isolated(const fs::path &latex_folder_path, std::size_t index,
+                                   const fs::path &latex_output_directory, const std::string &latex_compiler,
+                                   const std::string &latex_compiler_options, bool verbose) {
+  const std::string &name = std::to_string(index);
+  const fs::path &job_directory = latex_output_directory / name;
+  fs::create_directories(latex_folder_path / job_directory);
+  compile_markov_graph(latex_folder_path, name + ".tex", job_directory, latex_compiler, latex_compiler_options,
+                       verbose);
+  fs::rename(latex_folder_path / job_directory / (name + ".pdf"),
+             latex_folder_path / latex_output_directory / (name + ".pdf"));
+  fs::remove_all(latex_folder_path / job_directory);
+}
+
+void convert_pdf_to_png(const fs::path &file_path, const fs::path &output_path, const RasterOptions &options,
+                        bool verbose, std::size_t page_index) {
   // Ensure the input file exists
-  if (!fs::exists(folder_path)) {
-    throw std::runtime_error("Input folder does not exist: " + folder_path.string());
+  if (!fs::exists(file_path)) {
+    throw std::runtime_error("Input file does not exist: " + file_path.string());
+  }
+
+#ifdef MARKOV_VIDEO_POPPLER
+  (void)verbose;
+  // Every call loads its own document, poppler documents are not safe to share between threads.
+  const std::unique_ptr<poppler::document> document(poppler::document::load_from_file(file_path.string()));
+  if (!document || document->is_locked()) {
+    throw std::runtime_error("Cannot open PDF: " + file_path.string());
+  }
+  const std::unique_ptr<poppler::page> page(document->create_page(static_cast<int>(page_index)));
+  if (!page) {
+    throw std::runtime_error("PDF " + file_path.string() + " has no page " + std::to_string(page_index) + ".");
   }
 
-  for (std::size_t i = 0; i < file_count; i++) {
-    const fs::path &input_file_path = std::to_string(i) + ".pdf";
-    const fs::path &output_file_path = std::to_string(i) + ".png";
-    std::cout << "Converting " << input_file_path << " to " << output_file_path << "." << std::endl;
-    convert_pdf_to_png(folder_path / input_file_path, output_path / output_file_path, verbose);
+  // The page is rendered straight at the target resolution. PDF sizes are given in points, 72 per inch.
+  double dpi = options.dpi;
+  if (options.width != 0) {
+    dpi = options.width * 72.0 / page->page_rect(poppler::media_box).width();
+  }
+  poppler::page_renderer renderer;
+  renderer.set_render_hint(poppler::page_renderer::antialiasing, true);
+  renderer.set_render_hint(poppler::page_renderer::text_antialiasing, true);
+  const poppler::image image = renderer.render_page(page.get(), dpi, dpi);
+  if (!image.is_valid() || !image.save(output_path.string(), "png")) {
+    throw std::runtime_error("Cannot rasterize " + file_path.string() + " to " + output_path.string() + ".");
+  }
+#else
+  // ImageMagick selects a single page with the file[index] syntax. Without poppler the page size is unknown, so a
+  // requested width is reached by resizing.
+  std::ostringstream density;
+  density << options.dpi;
+  Command command = {"magick", "-density", density.str(), file_path.string() + "[" + std::to_string(page_index) + "]",
+                     "-quality", "100"};
+  if (options.width != 0) {
+    command.insert(command.end(), {"-resize", std::to_string(options.width) + "x"});
   }
+  command.push_back(output_path.string());
+
+  execute_command(command, verbose);
+#endif
 }